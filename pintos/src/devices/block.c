@@ -4,6 +4,10 @@
 #include <stdio.h>
 #include "devices/ide.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Most sectors the dispatcher merges into one driver request. */
+#define BLOCK_MERGE_MAX 64
 
 /* A block device. */
 struct block
@@ -19,6 +23,27 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+
+    /* Request queue.  The thread that finds the queue idle
+       dispatches requests, its own and others', until its own is
+       done, then hands the job to the oldest waiter. */
+    struct lock queue_lock;             /* Guards the members below. */
+    struct list queue;                  /* Pending block_requests. */
+    bool busy;                          /* Is a thread dispatching? */
+    block_sector_t next_sector;         /* Sector after the last dispatched. */
+  };
+
+/* A request to read or write CNT consecutive sectors, waiting in
+   a block device's queue. */
+struct block_request
+  {
+    struct list_elem elem;              /* Element in block's queue. */
+    block_sector_t sector;              /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+    void **buffers;                     /* One buffer per sector. */
+    bool write;                         /* Write, not read? */
+    bool done;                          /* Has it been carried out? */
+    struct semaphore sema;              /* Up'd when done or to dispatch. */
   };
 
 /* List of all block devices. */
@@ -113,6 +138,167 @@ check_sector (struct block *block, block_sector_t sector)
     }
 }
 
+/* Returns the request in BLOCK's queue to serve next.  Requests
+   are served in one sweep up the disk, C-LOOK style: the lowest
+   sector at or after the last one dispatched, or else the lowest
+   sector of all. */
+static struct block_request *
+pick_request (struct block *block)
+{
+  struct block_request *ahead = NULL;
+  struct block_request *lowest = NULL;
+  struct list_elem *e;
+
+  for (e = list_begin (&block->queue); e != list_end (&block->queue);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (lowest == NULL || r->sector < lowest->sector)
+        lowest = r;
+      if (r->sector >= block->next_sector
+          && (ahead == NULL || r->sector < ahead->sector))
+        ahead = r;
+    }
+  return ahead != NULL ? ahead : lowest;
+}
+
+/* Finds a request in BLOCK's queue in direction WRITE that
+   starts at SECTOR, or returns a null pointer. */
+static struct block_request *
+find_adjacent (struct block *block, block_sector_t sector, bool write)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&block->queue); e != list_end (&block->queue);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (r->sector == sector && r->write == write)
+        return r;
+    }
+  return NULL;
+}
+
+/* Serves requests from BLOCK's queue until MINE is done.  Each
+   round takes the next request in C-LOOK order, along with any
+   others that continue it on disk, and passes them to the driver
+   as one transfer.  Must be called with BLOCK's queue lock held,
+   which is dropped during each transfer. */
+static void
+dispatch (struct block *block, struct block_request *mine)
+{
+  while (!mine->done)
+    {
+      struct block_request *batch[BLOCK_MERGE_MAX];
+      void *buffers[BLOCK_MERGE_MAX];
+      struct block_request *first, *r;
+      block_sector_t sector;
+      size_t batch_cnt, cnt, i;
+      void **bufs;
+      bool write;
+
+      /* Gather the run. */
+      first = pick_request (block);
+      list_remove (&first->elem);
+      batch[0] = first;
+      batch_cnt = 1;
+      sector = first->sector;
+      write = first->write;
+      cnt = first->cnt;
+      bufs = first->buffers;
+      if (cnt < BLOCK_MERGE_MAX)
+        {
+          memcpy (buffers, first->buffers, cnt * sizeof *buffers);
+          while ((r = find_adjacent (block, sector + cnt, write)) != NULL
+                 && cnt + r->cnt <= BLOCK_MERGE_MAX)
+            {
+              list_remove (&r->elem);
+              memcpy (buffers + cnt, r->buffers, r->cnt * sizeof *buffers);
+              batch[batch_cnt++] = r;
+              cnt += r->cnt;
+            }
+          bufs = buffers;
+        }
+      block->next_sector = sector + cnt;
+      lock_release (&block->queue_lock);
+
+      /* Carry it out. */
+      if (write && block->ops->writev != NULL)
+        block->ops->writev (block->aux, sector, (const void **) bufs, cnt);
+      else if (!write && block->ops->readv != NULL)
+        block->ops->readv (block->aux, sector, bufs, cnt);
+      else
+        for (i = 0; i < cnt; i++)
+          if (write)
+            block->ops->write (block->aux, sector + i, bufs[i]);
+          else
+            block->ops->read (block->aux, sector + i, bufs[i]);
+
+      /* Complete the requests. */
+      lock_acquire (&block->queue_lock);
+      for (i = 0; i < batch_cnt; i++)
+        {
+          batch[i]->done = true;
+          if (batch[i] != mine)
+            sema_up (&batch[i]->sema);
+        }
+    }
+}
+
+/* Transfers CNT sectors starting at SECTOR between BLOCK and
+   BUFFERS, through BLOCK's request queue unless its driver is
+   stacked on another device.  Returns when the transfer is
+   done. */
+static void
+submit (struct block *block, block_sector_t sector, void **buffers,
+        size_t cnt, bool write)
+{
+  struct block_request r;
+
+  if (cnt == 0)
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+
+  if (block->ops->stacked)
+    {
+      if (write)
+        block->ops->writev (block->aux, sector, (const void **) buffers, cnt);
+      else
+        block->ops->readv (block->aux, sector, buffers, cnt);
+      return;
+    }
+
+  r.sector = sector;
+  r.cnt = cnt;
+  r.buffers = buffers;
+  r.write = write;
+  r.done = false;
+  sema_init (&r.sema, 0);
+
+  lock_acquire (&block->queue_lock);
+  list_push_back (&block->queue, &r.elem);
+  while (!r.done)
+    if (!block->busy)
+      {
+        block->busy = true;
+        dispatch (block, &r);
+        block->busy = false;
+
+        /* Hand dispatching over to the oldest waiter. */
+        if (!list_empty (&block->queue))
+          sema_up (&list_entry (list_front (&block->queue),
+                                struct block_request, elem)->sema);
+      }
+    else
+      {
+        lock_release (&block->queue_lock);
+        sema_down (&r.sema);
+        lock_acquire (&block->queue_lock);
+      }
+  lock_release (&block->queue_lock);
+}
+
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
    have room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to block devices, so external
@@ -120,9 +306,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_readv (block, sector, &buffer, 1);
 }
 /* Returns read_cnt of a block*/
 unsigned long long
@@ -139,10 +323,37 @@ block_print_read_cnt (struct block *block)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
+  block_writev (block, sector, &buffer, 1);
+}
+
+/* Reads the CNT consecutive sectors starting at SECTOR from
+   BLOCK, the I'th of them into BUFFERS[I], which must have room
+   for BLOCK_SECTOR_SIZE bytes.  The request waits in BLOCK's
+   queue, where it may be merged with its neighbors on disk.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_readv (struct block *block, block_sector_t sector, void **buffers,
+             size_t cnt)
+{
+  submit (block, sector, buffers, cnt, false);
+  block->read_cnt += cnt;
+}
+
+/* Writes the CNT consecutive sectors starting at SECTOR to
+   BLOCK, the I'th of them from BUFFERS[I], which must contain
+   BLOCK_SECTOR_SIZE bytes.  The request waits in BLOCK's queue,
+   where it may be merged with its neighbors on disk.  Returns
+   after the block device has acknowledged receiving the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_writev (struct block *block, block_sector_t sector,
+              const void **buffers, size_t cnt)
+{
   ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  submit (block, sector, (void **) buffers, cnt, true);
+  block->write_cnt += cnt;
 }
 
 /* Returns write_cnt of a block*/
@@ -213,6 +424,10 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  lock_init (&block->queue_lock);
+  list_init (&block->queue);
+  block->busy = false;
+  block->next_sector = 0;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
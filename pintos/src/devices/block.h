@@ -1,6 +1,7 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
 
@@ -55,6 +56,9 @@ void block_read (struct block *, block_sector_t, void *);
 unsigned long long block_print_read_cnt (struct block *);
 void block_write (struct block *, block_sector_t, const void *);
 unsigned long long block_print_write_cnt (struct block *);
+void block_readv (struct block *, block_sector_t, void **buffers, size_t cnt);
+void block_writev (struct block *, block_sector_t, const void **buffers,
+                   size_t cnt);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
@@ -67,6 +71,15 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional.  Transfer CNT consecutive sectors at once. */
+    void (*readv) (void *aux, block_sector_t, void **buffers, size_t cnt);
+    void (*writev) (void *aux, block_sector_t, const void **buffers,
+                    size_t cnt);
+
+    /* True if the driver hands requests to another block device,
+       which queues them, so they need no queue of their own. */
+    bool stacked;
   };
 
 struct block *block_register (const char *name, enum block_type,
@@ -8,7 +8,9 @@
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -30,10 +32,25 @@
 #define reg_ctl(CHANNEL) ((CHANNEL)->reg_base + 0x206)  /* Control (w/o). */
 #define reg_alt_status(CHANNEL) reg_ctl (CHANNEL)       /* Alt Status (r/o). */
 
+/* Bus-master DMA port addresses, relative to a channel's
+   bus-master base.  See [IDE-BM]. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table. */
+
 /* Alternate Status Register bits. */
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
+
+/* Bus-master Command Register bits. */
+#define BM_START 0x01           /* Start transfer. */
+#define BM_READ 0x08            /* Transfer from disk to memory. */
+
+/* Bus-master Status Register bits. */
+#define BM_ERROR 0x02           /* Transfer failed (write 1 to clear). */
+#define BM_INTR 0x04            /* Device interrupted (write 1 to clear). */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +66,12 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Most sectors one READ or WRITE SECTOR command can transfer.  A
+   sector count of 0 in the register means this many. */
+#define MAX_PIO_SECTORS 256
 
 /* An ATA device. */
 struct ata_disk
@@ -73,8 +96,33 @@ struct channel
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
     struct ata_disk devices[2];     /* The devices on this channel. */
+
+    uint16_t bm_base;           /* Bus-master base I/O port, 0 if no DMA. */
+    struct prd *prd_table;      /* Physical region descriptors for DMA. */
+  };
+
+/* A physical region descriptor, which tells the bus-master
+   controller where one piece of a DMA transfer goes in memory.
+   A region must not cross a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Size in bytes. */
+    uint16_t flags;             /* PRD_EOT on the last descriptor. */
   };
 
+#define PRD_EOT 0x8000          /* End of table. */
+#define PRD_CNT (PGSIZE / sizeof (struct prd))
+
+/* PCI configuration space ports and the PCI class of an IDE
+   controller. */
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+#define PCI_CLASS_IDE 0x0101
+
+/* See ide.h. */
+bool ide_dma;
+
 /* We support the two "legacy" ATA channels found in a standard PC. */
 #define CHANNEL_CNT 2
 static struct channel channels[CHANNEL_CNT];
@@ -85,7 +133,7 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void select_sector (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -97,6 +145,10 @@ static void select_device_wait (const struct ata_disk *);
 
 static void interrupt_handler (struct intr_frame *);
 
+static void init_dma (void);
+static bool dma_transfer (struct ata_disk *, block_sector_t,
+                          void **buffers, size_t cnt, bool read);
+
 /* Initialize the disk subsystem and detect disks. */
 void
 ide_init (void)
@@ -126,6 +178,8 @@ ide_init (void)
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      c->bm_base = 0;
+      c->prd_table = NULL;
 
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -153,6 +207,9 @@ ide_init (void)
         if (c->devices[dev_no].is_ata)
           identify_ata_device (&c->devices[dev_no]);
     }
+
+  if (ide_dma)
+    init_dma ();
 }
 
 /* Disk detection and identification. */
@@ -337,63 +394,121 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Reads the CNT sectors starting at SEC_NO from disk D, the I'th
+   into BUFFERS[I], which must have room for BLOCK_SECTOR_SIZE
+   bytes.  Each group of up to MAX_PIO_SECTORS sectors is one
+   READ SECTOR command, which interrupts once per sector.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_readv (void *d_, block_sector_t sec_no, void **buffers, size_t cnt)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
+  while (cnt > 0)
+    {
+      size_t n = cnt < MAX_PIO_SECTORS ? cnt : MAX_PIO_SECTORS;
+      size_t i;
+
+      if (dma_transfer (d, sec_no, buffers, n, true))
+        goto next;
+      select_sector (d, sec_no, n);
+      issue_pio_command (c, CMD_READ_SECTOR_RETRY);
+      for (i = 0; i < n; i++)
+        {
+          sema_down (&c->completion_wait);
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                   d->name, sec_no + i);
+          input_sector (c, buffers[i]);
+        }
+    next:
+      sec_no += n;
+      buffers += n;
+      cnt -= n;
+    }
   lock_release (&c->lock);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
+/* Writes the CNT sectors starting at SEC_NO to disk D, the I'th
+   from BUFFERS[I], which must contain BLOCK_SECTOR_SIZE bytes.
+   Each group of up to MAX_PIO_SECTORS sectors is one WRITE
+   SECTOR command.  Returns after the disk has acknowledged
+   receiving the data.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_writev (void *d_, block_sector_t sec_no, const void **buffers,
+            size_t cnt)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  while (cnt > 0)
+    {
+      size_t n = cnt < MAX_PIO_SECTORS ? cnt : MAX_PIO_SECTORS;
+      size_t i;
+
+      if (dma_transfer (d, sec_no, (void **) buffers, n, false))
+        goto next;
+      select_sector (d, sec_no, n);
+      issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
+      for (i = 0; i < n; i++)
+        {
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                   d->name, sec_no + i);
+          output_sector (c, buffers[i]);
+          sema_down (&c->completion_wait);
+        }
+    next:
+      sec_no += n;
+      buffers += n;
+      cnt -= n;
+    }
   lock_release (&c->lock);
 }
 
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes. */
+static void
+ide_read (void *d_, block_sector_t sec_no, void *buffer)
+{
+  ide_readv (d_, sec_no, &buffer, 1);
+}
+
+/* Write sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data. */
+static void
+ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+{
+  ide_writev (d_, sec_no, &buffer, 1);
+}
+
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_readv,
+    ide_writev,
+    false
   };
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the number of sectors CNT to the disk's
+   sector selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
-  ASSERT (sec_no < (1UL << 28));
+  ASSERT (sec_no + cnt <= (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= MAX_PIO_SECTORS);
 
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_PIO_SECTORS ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -502,6 +617,171 @@ select_device_wait (const struct ata_disk *d)
   wait_until_idle (d);
 }
 
+/* Bus-master DMA. */
+
+/* Reads and returns 32-bit register REG of PCI function FUNC of
+   device DEV on bus BUS. */
+static uint32_t
+pci_read_config (int bus, int dev, int func, int reg)
+{
+  outl (PCI_CONFIG_ADDR, (0x80000000 | (bus << 16) | (dev << 11)
+                          | (func << 8) | (reg & 0xfc)));
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes VALUE to 32-bit register REG of PCI function FUNC of
+   device DEV on bus BUS. */
+static void
+pci_write_config (int bus, int dev, int func, int reg, uint32_t value)
+{
+  outl (PCI_CONFIG_ADDR, (0x80000000 | (bus << 16) | (dev << 11)
+                          | (func << 8) | (reg & 0xfc)));
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Looks on PCI bus 0 for an IDE controller that can do bus-master
+   DMA, such as the PIIX, and enables bus mastering on it.
+   Returns its bus-master base I/O port, or 0 if there is none. */
+static uint16_t
+find_bus_master (void)
+{
+  int dev, func;
+
+  for (dev = 0; dev < 32; dev++)
+    for (func = 0; func < 8; func++)
+      {
+        uint32_t class, bar4;
+
+        if ((pci_read_config (0, dev, func, 0x00) & 0xffff) == 0xffff)
+          continue;
+        class = pci_read_config (0, dev, func, 0x08) >> 8;
+        if ((class >> 8) != PCI_CLASS_IDE || !(class & 0x80))
+          continue;
+        bar4 = pci_read_config (0, dev, func, 0x20);
+        if (!(bar4 & 1) || (bar4 & 0xfffc) == 0)
+          continue;
+
+        /* Enable I/O space and bus mastering. */
+        pci_write_config (0, dev, func, 0x04,
+                          pci_read_config (0, dev, func, 0x04) | 0x05);
+        return bar4 & 0xfffc;
+      }
+  return 0;
+}
+
+/* Sets up each channel to use bus-master DMA, if the controller
+   supports it.  Channels left without DMA use PIO. */
+static void
+init_dma (void)
+{
+  uint16_t bm_base = find_bus_master ();
+  size_t chan_no;
+
+  if (bm_base == 0)
+    {
+      printf ("ide: no bus-master IDE controller, using PIO\n");
+      return;
+    }
+
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    {
+      struct channel *c = &channels[chan_no];
+
+      c->prd_table = palloc_get_page (0);
+      if (c->prd_table == NULL)
+        continue;
+      c->bm_base = bm_base + 8 * chan_no;
+      outb (reg_bm_command (c), 0);
+      outb (reg_bm_status (c), BM_ERROR | BM_INTR);
+      printf ("%s: using bus-master DMA\n", c->name);
+    }
+}
+
+/* Fills channel C's PRD table to describe the CNT sectors in
+   BUFFERS.  Returns false if they cannot be described, because a
+   buffer is not in kernel memory or not word-aligned. */
+static bool
+build_prd_table (struct channel *c, void **buffers, size_t cnt)
+{
+  struct prd *prd = c->prd_table;
+  size_t n = 0;
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      uint8_t *p = buffers[i];
+      size_t left = BLOCK_SECTOR_SIZE;
+
+      if (!is_kernel_vaddr (p) || ((uintptr_t) p & 1) != 0)
+        return false;
+      while (left > 0)
+        {
+          uint32_t phys = vtop (p);
+          size_t chunk = 0x10000 - (phys & 0xffff);
+          if (chunk > left)
+            chunk = left;
+
+          /* Extend the previous region if this one follows it and
+             ends in the same 64 kB as it starts, otherwise start a
+             new one. */
+          if (n > 0 && prd[n - 1].addr + prd[n - 1].size == phys
+              && (prd[n - 1].addr & ~0xffff) == ((phys + chunk - 1) & ~0xffff))
+            prd[n - 1].size += chunk;
+          else
+            {
+              if (n >= PRD_CNT)
+                return false;
+              prd[n].addr = phys;
+              prd[n].size = chunk;
+              prd[n].flags = 0;
+              n++;
+            }
+          p += chunk;
+          left -= chunk;
+        }
+    }
+  prd[n - 1].flags = PRD_EOT;
+  return true;
+}
+
+/* Transfers the CNT sectors starting at SEC_NO between disk D
+   and BUFFERS by bus-master DMA, reading from the disk if READ
+   is true, writing to it otherwise.  Waits for the single
+   completion interrupt.  Returns false without touching the disk
+   if D's channel cannot do DMA or BUFFERS are unsuitable for it,
+   in which case the caller should fall back to PIO.
+   The caller must hold the channel lock. */
+static bool
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, void **buffers,
+              size_t cnt, bool read)
+{
+  struct channel *c = d->channel;
+  uint8_t direction = read ? BM_READ : 0;
+  uint8_t bm_status;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+
+  if (c->bm_base == 0 || !build_prd_table (c, buffers, cnt))
+    return false;
+
+  outl (reg_bm_prdt (c), vtop (c->prd_table));
+  outb (reg_bm_command (c), direction);
+  outb (reg_bm_status (c), BM_ERROR | BM_INTR);
+
+  select_sector (d, sec_no, cnt);
+  issue_pio_command (c, read ? CMD_READ_DMA : CMD_WRITE_DMA);
+  outb (reg_bm_command (c), direction | BM_START);
+  sema_down (&c->completion_wait);
+  outb (reg_bm_command (c), direction);
+
+  bm_status = inb (reg_bm_status (c));
+  outb (reg_bm_status (c), BM_ERROR | BM_INTR);
+  if ((bm_status & BM_ERROR) || (inb (reg_alt_status (c)) & STA_ERR))
+    PANIC ("%s: DMA %s failed, sector=%"PRDSNu,
+           d->name, read ? "read" : "write", sec_no);
+  return true;
+}
+
 /* ATA interrupt handler. */
 static void
 interrupt_handler (struct intr_frame *f)
@@ -1,6 +1,13 @@
 #ifndef DEVICES_IDE_H
 #define DEVICES_IDE_H
 
+#include <stdbool.h>
+
+/* If false (default), move disk data with programmed I/O.
+   If true, use PCI bus-master DMA where the controller has it.
+   Controlled by kernel command-line option "-dma". */
+extern bool ide_dma;
+
 void ide_init (void);
 
 #endif /* devices/ide.h */
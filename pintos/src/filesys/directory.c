@@ -2,9 +2,181 @@
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include <hash.h>
+#include <round.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* A directory is a hash table of buckets, each one sector of
+   directory entries.  An entry for NAME is kept in bucket
+   hash_string(NAME) % N, where N is the number of buckets, which
+   is the directory's length in sectors.  When an entry must go
+   into a bucket that is full, the table doubles: every bucket I
+   is split between buckets I and I + N, which is where its
+   entries belong under the new modulus, so no entry ever needs
+   a bucket other than its own.  Buckets that stay empty are
+   never written and occupy no disk space in a sparse file.
+
+   dir_readdir() still walks the entries in file order, so it
+   sees every entry of a directory that is not being modified. */
+#define DIR_BUCKET_SIZE BLOCK_SECTOR_SIZE
+#define DIR_BUCKET_ENTRIES (DIR_BUCKET_SIZE / sizeof (struct dir_entry))
+
+/* Largest number of buckets a directory may grow to. */
+#define DIR_BUCKET_MAX 8192
+
+/* Serializes changes to directories against each other and
+   against lookups, so that no one sees a bucket mid-split.
+   Also guards the name cache. */
+static struct lock dir_lock;
+
+/* Name cache.
+
+   Remembers the outcome of recent lookups, keyed by the sector
+   of the directory searched and the name searched for, so that
+   resolving the same path again costs a hash probe per
+   component instead of a bucket read.  A negative entry records
+   that the name was not found.  Entries are dropped when
+   dir_add() or dir_remove() changes the name, when the directory
+   grows and its entries move, and when the directory's sector
+   is reused for a newly linked inode. */
+#define DCACHE_MAX 512
+
+struct dentry
+  {
+    struct hash_elem hash_elem;         /* Element in dcache. */
+    struct list_elem lru_elem;          /* Element in dcache_lru. */
+    block_sector_t parent;              /* Sector of directory searched. */
+    char name[NAME_MAX + 1];            /* Name searched for. */
+    bool negative;                      /* True if NAME was not found. */
+    struct dir_entry entry;             /* Entry found, if not NEGATIVE. */
+    off_t ofs;                          /* Byte offset of ENTRY. */
+  };
+
+static struct hash dcache;              /* Cached dentries. */
+static struct list dcache_lru;          /* Dentries, most recent first. */
+static size_t dcache_cnt;               /* Number of cached dentries. */
+
+/* Returns a hash value for dentry E. */
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+  return hash_string (d->name) ^ hash_int (d->parent);
+}
+
+/* Returns true if dentry A precedes dentry B. */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+  if (a->parent != b->parent)
+    return a->parent < b->parent;
+  return strcmp (a->name, b->name) < 0;
+}
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  lock_init (&dir_lock);
+  if (!hash_init (&dcache, dentry_hash, dentry_less, NULL))
+    PANIC ("name cache creation failed");
+  list_init (&dcache_lru);
+  dcache_cnt = 0;
+}
+
+/* Returns the cached dentry for NAME in the directory at sector
+   PARENT, or a null pointer if there is none. */
+static struct dentry *
+dcache_find (block_sector_t parent, const char *name)
+{
+  struct dentry key, *d;
+  struct hash_elem *e;
+
+  if (strlen (name) > NAME_MAX)
+    return NULL;
+  key.parent = parent;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dcache, &key.hash_elem);
+  if (e == NULL)
+    return NULL;
+
+  d = hash_entry (e, struct dentry, hash_elem);
+  list_remove (&d->lru_elem);
+  list_push_front (&dcache_lru, &d->lru_elem);
+  return d;
+}
+
+/* Removes dentry D from the cache and frees it. */
+static void
+dcache_drop (struct dentry *d)
+{
+  hash_delete (&dcache, &d->hash_elem);
+  list_remove (&d->lru_elem);
+  dcache_cnt--;
+  free (d);
+}
+
+/* Caches the outcome of looking up NAME in the directory at
+   sector PARENT: entry E at byte offset OFS, or a negative entry
+   if E is null.  Evicts the least recently used dentry if the
+   cache is full.  Does nothing if memory is short. */
+static void
+dcache_insert (block_sector_t parent, const char *name,
+               const struct dir_entry *e, off_t ofs)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+  if (dcache_cnt >= DCACHE_MAX)
+    dcache_drop (list_entry (list_back (&dcache_lru),
+                             struct dentry, lru_elem));
+  d = malloc (sizeof *d);
+  if (d == NULL)
+    return;
+
+  d->parent = parent;
+  strlcpy (d->name, name, sizeof d->name);
+  d->negative = e == NULL;
+  if (e != NULL)
+    d->entry = *e;
+  d->ofs = ofs;
+  hash_insert (&dcache, &d->hash_elem);
+  list_push_front (&dcache_lru, &d->lru_elem);
+  dcache_cnt++;
+}
+
+/* Drops any cached dentry for NAME in the directory at sector
+   PARENT. */
+static void
+dcache_invalidate (block_sector_t parent, const char *name)
+{
+  struct dentry *d = dcache_find (parent, name);
+  if (d != NULL)
+    dcache_drop (d);
+}
+
+/* Drops every cached dentry for the directory at sector
+   PARENT. */
+static void
+dcache_invalidate_dir (block_sector_t parent)
+{
+  struct list_elem *e, *next;
+
+  for (e = list_begin (&dcache_lru); e != list_end (&dcache_lru); e = next)
+    {
+      struct dentry *d = list_entry (e, struct dentry, lru_elem);
+      next = list_next (e);
+      if (d->parent == parent)
+        dcache_drop (d);
+    }
+}
 
 /* Extracts a file name part from *SRCP into PART, and updates *SRCP so that the
  * next call will return the next file name part. Returns 1 if successful, 0 at
@@ -39,7 +211,9 @@ get_next_part (char part[NAME_MAX + 1], const char **srcp)
 bool
 dir_create (block_sector_t sector, size_t entry_cnt)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  size_t bucket_cnt = DIV_ROUND_UP (entry_cnt, DIR_BUCKET_ENTRIES);
+  return inode_create (sector, (bucket_cnt > 0 ? bucket_cnt : 1)
+                               * DIR_BUCKET_SIZE);
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -96,32 +270,162 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
+/* Returns the number of buckets in DIR. */
+static size_t
+bucket_cnt (const struct dir *dir)
+{
+  size_t cnt = DIV_ROUND_UP (inode_length (dir->inode), DIR_BUCKET_SIZE);
+  return cnt > 0 ? cnt : 1;
+}
+
+/* Returns the bucket that an entry for NAME belongs in, in a
+   directory of BUCKET_CNT buckets. */
+static size_t
+name_bucket (const char *name, size_t bucket_cnt)
+{
+  return hash_string (name) % bucket_cnt;
+}
+
+/* Reads bucket IDX of DIR into ENTRIES.  Any part of the bucket
+   past the end of the directory reads as unused entries. */
+static void
+read_bucket (const struct dir *dir, size_t idx, struct dir_entry *entries)
+{
+  off_t ofs = (off_t) idx * DIR_BUCKET_SIZE;
+  off_t size = DIR_BUCKET_ENTRIES * sizeof *entries;
+  off_t read = inode_read_at (dir->inode, entries, size, ofs);
+
+  if (read < size)
+    memset ((uint8_t *) entries + read, 0, size - read);
+}
+
+/* Writes ENTRIES to bucket IDX of DIR.  Returns true if
+   successful, false on failure. */
+static bool
+write_bucket (struct dir *dir, size_t idx, const struct dir_entry *entries)
+{
+  off_t ofs = (off_t) idx * DIR_BUCKET_SIZE;
+  off_t size = DIR_BUCKET_ENTRIES * sizeof *entries;
+
+  return inode_write_at (dir->inode, entries, size, ofs) == size;
+}
+
+/* Doubles the number of buckets in DIR, moving each entry to
+   the bucket it belongs in under the new count.  ENTRIES and
+   MOVED are scratch buckets.  Returns true if successful, false
+   if the directory is already as large as it may grow or a disk
+   error occurs, in which case DIR is left as it was.
+
+   The bucket count follows from DIR's length, so the new count
+   takes effect as soon as the new buckets are written.  They are
+   all written, holding copies of the entries that move, before
+   any old bucket changes; if one fails, the length goes back.
+   Only then are the moved entries erased from the old buckets,
+   which rewrites sectors DIR already has and so cannot fail for
+   lack of space. */
+static bool
+grow (struct dir *dir, struct dir_entry *entries, struct dir_entry *moved)
+{
+  size_t old_cnt = bucket_cnt (dir);
+  size_t new_cnt = old_cnt * 2;
+  off_t old_length = inode_length (dir->inode);
+  size_t i, j;
+
+  if (new_cnt > DIR_BUCKET_MAX)
+    return false;
+
+  /* Entries are about to move to new offsets. */
+  dcache_invalidate_dir (inode_get_inumber (dir->inode));
+
+  /* Copy the entries that move into the new buckets. */
+  for (i = 0; i < old_cnt; i++)
+    {
+      read_bucket (dir, i, entries);
+      memset (moved, 0, DIR_BUCKET_SIZE);
+      for (j = 0; j < DIR_BUCKET_ENTRIES; j++)
+        if (entries[j].in_use && name_bucket (entries[j].name, new_cnt) != i)
+          moved[j] = entries[j];
+      if (!write_bucket (dir, i + old_cnt, moved))
+        {
+          inode_shrink (dir->inode, old_length);
+          return false;
+        }
+    }
+
+  /* Erase them from the old ones. */
+  for (i = 0; i < old_cnt; i++)
+    {
+      bool any_moved = false;
+
+      read_bucket (dir, i, entries);
+      for (j = 0; j < DIR_BUCKET_ENTRIES; j++)
+        if (entries[j].in_use && name_bucket (entries[j].name, new_cnt) != i)
+          {
+            entries[j].in_use = false;
+            any_moved = true;
+          }
+      if (any_moved && !write_bucket (dir, i, entries))
+        return false;
+    }
+  return true;
+}
+
 /* Searches DIR for a file with the given NAME.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
    directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   otherwise, returns false and ignores EP and OFSP.
+   The name cache is consulted first.  On a miss, only the bucket
+   that NAME belongs in is read, and the outcome is cached.  The
+   caller must hold dir_lock. */
 static bool
 lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp)
 {
-  struct dir_entry e;
-  size_t ofs;
+  block_sector_t parent;
+  struct dentry *d;
+  struct dir_entry *entries;
+  size_t idx, i;
+  bool found = false;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e)
-    if (e.in_use && !strcmp (name, e.name))
+  parent = inode_get_inumber (dir->inode);
+  d = dcache_find (parent, name);
+  if (d != NULL)
+    {
+      if (d->negative)
+        return false;
+      if (ep != NULL)
+        *ep = d->entry;
+      if (ofsp != NULL)
+        *ofsp = d->ofs;
+      return true;
+    }
+
+  entries = malloc (DIR_BUCKET_SIZE);
+  if (entries == NULL)
+    return false;
+
+  idx = name_bucket (name, bucket_cnt (dir));
+  read_bucket (dir, idx, entries);
+  for (i = 0; i < DIR_BUCKET_ENTRIES; i++)
+    if (entries[i].in_use && !strcmp (name, entries[i].name))
       {
+        off_t ofs = idx * DIR_BUCKET_SIZE + i * sizeof *entries;
         if (ep != NULL)
-          *ep = e;
+          *ep = entries[i];
         if (ofsp != NULL)
           *ofsp = ofs;
-        return true;
+        dcache_insert (parent, name, &entries[i], ofs);
+        found = true;
+        break;
       }
-  return false;
+  if (!found)
+    dcache_insert (parent, name, NULL, 0);
+  free (entries);
+  return found;
 }
 
 /*find if there is any file on the given path,
@@ -192,8 +496,12 @@ dir_getdirent(const struct dir *dir, const char *name)
   char tail_name[NAME_MAX +1];
   off_t temp;
   struct dir* now_dir = (struct dir*) malloc(sizeof (struct dir));
+  bool found;
   find_path(dir, name, &tail_name, now_dir);
-  if(lookup(now_dir, tail_name, ent, &temp))
+  lock_acquire (&dir_lock);
+  found = lookup(now_dir, tail_name, ent, &temp);
+  lock_release (&dir_lock);
+  if(found)
     return ent;
   return NULL;
 }
@@ -210,10 +518,12 @@ dir_lookup (const struct dir *dir, const char *name,
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  lock_acquire (&dir_lock);
   if (lookup (dir, name, &e, NULL))
     *inode = inode_open (e.inode_sector);
   else
     *inode = NULL;
+  lock_release (&dir_lock);
 
   return *inode != NULL;
 }
@@ -227,8 +537,9 @@ dir_lookup (const struct dir *dir, const char *name,
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector, int type)
 {
+  struct dir_entry *entries, *scratch = NULL;
   struct dir_entry e;
-  off_t ofs;
+  size_t idx, i;
   bool success = false;
 
   ASSERT (dir != NULL);
@@ -238,30 +549,55 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector, int typ
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
+  entries = malloc (DIR_BUCKET_SIZE);
+  if (entries == NULL)
+    return false;
+  lock_acquire (&dir_lock);
+
   /* Check that NAME is not in use. */
   if (lookup (dir, name, NULL, NULL))
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e)
-    if (!e.in_use)
-      break;
+  /* Find a free slot in NAME's bucket, growing the directory
+     until its bucket has one. */
+  for (;;)
+    {
+      idx = name_bucket (name, bucket_cnt (dir));
+      read_bucket (dir, idx, entries);
+      for (i = 0; i < DIR_BUCKET_ENTRIES; i++)
+        if (!entries[i].in_use)
+          break;
+      if (i < DIR_BUCKET_ENTRIES)
+        break;
+
+      if (scratch == NULL)
+        {
+          scratch = malloc (DIR_BUCKET_SIZE);
+          if (scratch == NULL)
+            goto done;
+        }
+      if (!grow (dir, entries, scratch))
+        goto done;
+    }
 
   /* Write slot. */
+  memset (&e, 0, sizeof e);
   e.in_use = true;
   e.type = type;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  success = inode_write_at (dir->inode, &e, sizeof e,
+                            idx * DIR_BUCKET_SIZE + i * sizeof e) == sizeof e;
+
+  /* Forget that NAME was missing, and anything remembered about
+     a directory that used to live at INODE_SECTOR. */
+  dcache_invalidate (inode_get_inumber (dir->inode), name);
+  dcache_invalidate_dir (inode_sector);
 
  done:
+  lock_release (&dir_lock);
+  free (scratch);
+  free (entries);
   return success;
 }
 
@@ -280,6 +616,7 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (name != NULL);
 
   /* Find directory entry. */
+  lock_acquire (&dir_lock);
   if (!lookup (dir, name, &e, &ofs))
     goto done;
 
@@ -312,6 +649,7 @@ dir_remove (struct dir *dir, const char *name)
 
   /* Erase directory entry. */
   e.in_use = false;
+  dcache_invalidate (inode_get_inumber (dir->inode), name);
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
     goto done;
 
@@ -320,10 +658,28 @@ dir_remove (struct dir *dir, const char *name)
   success = true;
 
  done:
+  lock_release (&dir_lock);
   inode_close (inode);
   return success;
 }
 
+/* Reads the next directory entry in DIR, other than "." and
+   "..", into *EP.  Returns true if successful, false if the
+   directory contains no more entries. */
+static bool
+readdir_entry (struct dir *dir, struct dir_entry *ep)
+{
+  while (inode_read_at (dir->inode, ep, sizeof *ep, dir->pos) == sizeof *ep)
+    {
+      dir->pos += sizeof *ep;
+      if (!strcmp (ep->name, ".") || !strcmp (ep->name, ".."))
+        continue;
+      if (ep->in_use)
+        return true;
+    }
+  return false;
+}
+
 /* Reads the next directory entry in DIR and stores the name in
    NAME.  Returns true if successful, false if the directory
    contains no more entries. */
@@ -332,18 +688,29 @@ dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e)
+  if (!readdir_entry (dir, &e))
+    return false;
+  strlcpy (name, e.name, NAME_MAX + 1);
+  return true;
+}
+
+/* Reads up to CNT of the next directory entries in DIR into
+   ENTRIES, with the inode number and type of each.  Returns the
+   number of entries read, which is 0 once the directory
+   contains no more entries. */
+size_t
+dir_getdents (struct dir *dir, struct dirent *entries, size_t cnt)
+{
+  struct dir_entry e;
+  size_t i;
+
+  for (i = 0; i < cnt && readdir_entry (dir, &e); i++)
     {
-      dir->pos += sizeof e;
-      if (!strcmp (e.name, ".") || !strcmp (e.name, ".."))
-        continue;
-      if (e.in_use)
-        {
-          strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
-        }
+      entries[i].d_ino = e.inode_sector;
+      entries[i].d_type = e.type == IS_DIR ? DT_DIR : DT_REG;
+      strlcpy (entries[i].d_name, e.name, sizeof entries[i].d_name);
     }
-  return false;
+  return i;
 }
 
 /* open work directory of the thread, or root*/
@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <dirent.h>
 #include "devices/block.h"
 #include "filesys/off_t.h"
 #include "threads/thread.h"
@@ -37,6 +38,8 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+void dir_init (void);
+
 /* Opening and closing directories. */
 bool dir_create (block_sector_t sector, size_t entry_cnt);
 struct dir *dir_open (struct inode *);
@@ -50,6 +53,7 @@ bool dir_lookup (const struct dir *, const char *name, struct inode **);
 bool dir_add (struct dir *, const char *name, block_sector_t, int type);
 bool dir_remove (struct dir *, const char *name);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
+size_t dir_getdents (struct dir *, struct dirent *, size_t cnt);
 
 /*helper function to iteratively find long path*/
 bool find_path(const struct dir *dir, const char *name,
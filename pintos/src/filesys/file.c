@@ -3,14 +3,30 @@
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 
+/* How far ahead of a sequential reader to read, in bytes. */
+#define READ_AHEAD_BYTES (8 * BLOCK_SECTOR_SIZE)
+
 /* An open file. */
 struct file
   {
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    off_t read_end;             /* Where the last read ended. */
   };
 
+/* Notes that SIZE bytes were just read from FILE at offset
+   START.  If the read picked up where the previous one ended,
+   the access looks sequential, so the data after it is read
+   ahead. */
+static void
+note_read (struct file *file, off_t start, off_t size)
+{
+  if (size > 0 && start == file->read_end)
+    inode_read_ahead (file->inode, start + size, READ_AHEAD_BYTES);
+  file->read_end = start + size;
+}
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -23,6 +39,7 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->read_end = 0;
       return file;
     }
   else
@@ -69,6 +86,7 @@ off_t
 file_read (struct file *file, void *buffer, off_t size)
 {
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  note_read (file, file->pos, bytes_read);
   file->pos += bytes_read;
   return bytes_read;
 }
@@ -81,7 +99,23 @@ file_read (struct file *file, void *buffer, off_t size)
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
 {
-  return inode_read_at (file->inode, buffer, size, file_ofs);
+  off_t bytes_read = inode_read_at (file->inode, buffer, size, file_ofs);
+  note_read (file, file_ofs, bytes_read);
+  return bytes_read;
+}
+
+/* Reads from FILE, starting at the file's current position,
+   into the CNT buffers in IOV in turn.
+   Returns the number of bytes actually read,
+   which may be less than requested if end of file is reached.
+   Advances FILE's position by the number of bytes read. */
+off_t
+file_readv (struct file *file, const struct iovec *iov, int cnt)
+{
+  off_t bytes_read = inode_readv_at (file->inode, iov, cnt, file->pos);
+  note_read (file, file->pos, bytes_read);
+  file->pos += bytes_read;
+  return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
@@ -113,6 +147,18 @@ file_write_at (struct file *file, const void *buffer, off_t size,
   return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Writes the CNT buffers in IOV, one after another, into FILE,
+   starting at the file's current position.
+   Returns the number of bytes actually written.
+   Advances FILE's position by the number of bytes written. */
+off_t
+file_writev (struct file *file, const struct iovec *iov, int cnt)
+{
+  off_t bytes_written = inode_writev_at (file->inode, iov, cnt, file->pos);
+  file->pos += bytes_written;
+  return bytes_written;
+}
+
 /* Prevents write operations on FILE's underlying inode
    until file_allow_write() is called or FILE is closed. */
 void
@@ -24,6 +24,7 @@ filesys_init (bool format)
     PANIC ("No file system device found, can't initialize file system.");
 
   inode_init ();
+  dir_init ();
   free_map_init ();
 
   if (format)
@@ -50,8 +51,12 @@ filesys_create (const char *name, off_t initial_size, int type)
 {
   block_sector_t inode_sector = 0;
   struct dir *dir = dir_open_current ();
+
+  /* Place the new inode near its directory's. */
+  block_sector_t goal = (dir != NULL
+                         ? inode_get_inumber (dir_get_inode (dir)) : 0);
   bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
+                  && free_map_allocate_near (goal, 1, &inode_sector)
                   && inode_create (inode_sector, initial_size)
                   && dir_add (dir, name, inode_sector, type));
   if (!success && inode_sector != 0)
@@ -1,12 +1,24 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/synch.h"
+
+/* Number of free map bits in one sector of the free map file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static block_sector_t rotor;         /* Where free_map_allocate() looks. */
+
+/* Changes to the free map reach its file only when
+   free_map_flush() writes out the sectors of it that changed,
+   which DIRTY_SECTORS records, one bit per sector of the file. */
+static struct bitmap *dirty_sectors;
+static struct lock free_map_lock;    /* Guards all of the above. */
 
 /* Initializes the free map. */
 void
@@ -17,36 +29,161 @@ free_map_init (void)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+
+  dirty_sectors = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                               BLOCK_SECTOR_SIZE));
+  if (dirty_sectors == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  lock_init (&free_map_lock);
+}
+
+/* Notes that the free map bits for the CNT sectors starting at
+   SECTOR changed.  The caller must hold free_map_lock. */
+static void
+mark_dirty (block_sector_t sector, size_t cnt)
+{
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+
+  ASSERT (cnt > 0);
+  bitmap_set_multiple (dirty_sectors, first, last - first + 1, true);
+}
+
+/* Finds CNT consecutive free sectors, looking first at or after
+   GOAL and then from the start of the disk, and marks them in
+   use.  Returns the first one, or BITMAP_ERROR if there is no
+   such run. */
+static size_t
+scan_and_flip (block_sector_t goal, size_t cnt)
+{
+  size_t sector;
+
+  if (goal >= bitmap_size (free_map))
+    goal = 0;
+  sector = bitmap_scan_and_flip (free_map, goal, cnt, false);
+  if (sector == BITMAP_ERROR && goal > 0)
+    sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
+  return sector;
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+   the first into *SECTORP.  The search picks up where the last
+   one left off, so it need not rescan the full part of the
+   disk each time.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  size_t sector;
+
+  lock_acquire (&free_map_lock);
+  sector = scan_and_flip (rotor, cnt);
+  if (sector != BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false);
-      sector = BITMAP_ERROR;
+      mark_dirty (sector, cnt);
+      rotor = sector + cnt;
+      *sectorp = sector;
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
+  lock_release (&free_map_lock);
   return sector != BITMAP_ERROR;
 }
 
+/* Allocates up to CNT consecutive sectors close after GOAL,
+   such as the sector before them in the same file, and stores
+   the first into *SECTORP.  Prefers the first run of all CNT at
+   or after GOAL, wrapping around to the start of the disk; if
+   there is none, takes the first free run after GOAL however
+   short it is.
+   Returns the number of sectors allocated, 0 if the disk is
+   full. */
+size_t
+free_map_allocate_near (block_sector_t goal, size_t cnt,
+                        block_sector_t *sectorp)
+{
+  size_t size = bitmap_size (free_map);
+  size_t sector;
+  size_t n = cnt;
+
+  if (cnt == 0)
+    return 0;
+  lock_acquire (&free_map_lock);
+  sector = scan_and_flip (goal, cnt);
+  if (sector == BITMAP_ERROR)
+    {
+      sector = scan_and_flip (goal, 1);
+      if (sector == BITMAP_ERROR)
+        {
+          lock_release (&free_map_lock);
+          return 0;
+        }
+      for (n = 1; n < cnt && sector + n < size; n++)
+        if (bitmap_test (free_map, sector + n))
+          break;
+      bitmap_set_multiple (free_map, sector + 1, n - 1, true);
+    }
+  mark_dirty (sector, n);
+  lock_release (&free_map_lock);
+  *sectorp = sector;
+  return n;
+}
+
+/* Allocates up to CNT consecutive sectors starting at SECTOR,
+   stopping at the first sector already in use, so that a file
+   can grow in place.
+   Returns the number of sectors allocated, which may be 0. */
+size_t
+free_map_allocate_at (block_sector_t sector, size_t cnt)
+{
+  size_t size = bitmap_size (free_map);
+  size_t n;
+
+  lock_acquire (&free_map_lock);
+  for (n = 0; n < cnt && sector + n < size; n++)
+    if (bitmap_test (free_map, sector + n))
+      break;
+  if (n > 0)
+    {
+      bitmap_set_multiple (free_map, sector, n, true);
+      mark_dirty (sector, n);
+    }
+  lock_release (&free_map_lock);
+  return n;
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  mark_dirty (sector, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Writes the sectors of the free map file whose bits changed
+   since they were last written.  Does nothing if the free map
+   file is not open. */
+void
+free_map_flush (void)
+{
+  size_t bit_cnt = bitmap_size (free_map);
+  size_t i;
+
+  lock_acquire (&free_map_lock);
+  if (free_map_file != NULL)
+    for (i = 0; i < bitmap_size (dirty_sectors); i++)
+      if (bitmap_test (dirty_sectors, i))
+        {
+          size_t start = i * BITS_PER_SECTOR;
+          size_t cnt = bit_cnt - start;
+          if (cnt > BITS_PER_SECTOR)
+            cnt = BITS_PER_SECTOR;
+          if (bitmap_write_range (free_map, free_map_file, start, cnt))
+            bitmap_reset (dirty_sectors, i);
+        }
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -64,7 +201,17 @@ free_map_open (void)
 void
 free_map_close (void)
 {
-  file_close (free_map_file);
+  struct file *file;
+
+  free_map_flush ();
+  lock_acquire (&free_map_lock);
+  file = free_map_file;
+  free_map_file = NULL;
+  lock_release (&free_map_lock);
+
+  /* Closed outside free_map_lock, which inode_close() may need
+     to release a removed file's sectors. */
+  file_close (file);
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -82,4 +229,5 @@ free_map_create (void)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (dirty_sectors, false);
 }
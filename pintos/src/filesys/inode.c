@@ -1,26 +1,80 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <uio.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
 
 
 /* Testing Git 2*/
-/* Identifies an inode. */
+/* Identifies an inode.  INODE_MAGIC inodes map their data one
+   sector at a time through direct, indirect and doubly indirect
+   pointers; INODE_EXTENT_MAGIC inodes map it as runs of
+   consecutive sectors. */
 #define INODE_MAGIC 0x494e4f44
+#define INODE_EXTENT_MAGIC 0x494e4f45
 
+/* Number of extents in an INODE_EXTENT_MAGIC inode. */
+#define INODE_EXTENT_CNT 63
+
+/* Number of sectors an INODE_MAGIC inode can map: direct,
+   indirect, and doubly indirect. */
+#define INODE_BLOCK_CNT (124 + 128 + 128 * 128)
+
+/* Number of block-map translations each open inode remembers. */
+#define INODE_XLATE_CNT 16
+
+/* Default and smallest buffer cache sizes, in sectors. */
 #define CACHE_SIZE 32
+#define CACHE_MIN 16
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* The write-behind thread wakes up this often, and also whenever
+   more than 1/CACHE_DIRTY_RATIO of the entries are dirty. */
+#define WRITE_BEHIND_TICKS (5 * TIMER_FREQ)
+#define CACHE_DIRTY_RATIO 2
+
+/* Most sectors read or written back as one device request. */
+#define CACHE_RUN_MAX 8
+
+/* Maximum number of sectors waiting for the read-ahead thread.
+   Further requests are dropped until it catches up. */
+#define READ_AHEAD_QUEUE 64
+/* LENGTH consecutive sectors starting at START. */
+struct inode_extent
+  {
+    block_sector_t start;               /* First sector. */
+    block_sector_t length;              /* Number of sectors. */
+  };
+
 /* On-disk inode.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
 struct inode_disk
   {
-    block_sector_t direct[124]; /* 12 direct pointers */
-    block_sector_t indirect; /* a singly indirect pointer */
-    block_sector_t doubly_indirect; /* a doubly indirect pointer */
+    union
+      {
+        struct                          /* INODE_MAGIC layout. */
+          {
+            block_sector_t direct[124]; /* 12 direct pointers */
+            block_sector_t indirect; /* a singly indirect pointer */
+            block_sector_t doubly_indirect; /* a doubly indirect pointer */
+          };
+        /* INODE_EXTENT_MAGIC layout.  Extents are used in order;
+           the first with zero length ends the list. */
+        struct inode_extent extents[INODE_EXTENT_CNT];
+      };
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
   };
@@ -34,305 +88,744 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
+/* A remembered translation from logical sector IDX of an
+   INODE_MAGIC-layout file to the SECTOR holding it, which is 0
+   for a hole.  Only sectors past the direct pointers are worth
+   remembering, so IDX 0 marks an unused slot. */
+struct inode_xlate
+  {
+    block_sector_t idx;
+    block_sector_t sector;
+  };
+
 /* In-memory inode. */
 struct inode
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
-    int open_cnt;                       /* Number of openers. */
+    int open_cnt;                       /* Number of openers, guarded by
+                                           open_inodes_lock. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct lock lock;                   /* Guards DATA and DIRTY. */
+    struct inode_disk data;             /* Copy of the on-disk inode. */
+    bool dirty;                         /* DATA differs from disk. */
+    struct inode_xlate xlate[INODE_XLATE_CNT]; /* Guarded by LOCK. */
   };
 
+/* A cached copy of one disk sector.
+
+   SECTOR, HASH_ELEM, ACCESSED and REF_COUNT are guarded by
+   cache.lock.  DATA and DIRTY are guarded by LOCK, which a thread
+   may only wait on after bumping REF_COUNT, so an entry whose
+   REF_COUNT is zero is never locked and can be evicted. */
 struct cache_entry
   {
-    block_sector_t sector;
-    struct lock lock;
-    int ref_count;
-    bool write;
-    char data[BLOCK_SECTOR_SIZE];
+    block_sector_t sector;              /* Cached sector, -1 if unused. */
+    struct hash_elem hash_elem;         /* Element in cache.index. */
+    struct lock lock;                   /* Guards DATA and DIRTY. */
+    int ref_count;                      /* Threads holding or awaiting LOCK. */
+    bool accessed;                      /* Used since the clock hand passed? */
+    bool dirty;                         /* Modified since read or written? */
+    uint8_t *data;                      /* BLOCK_SECTOR_SIZE bytes. */
   };
 
 struct block_cache
   {
-    struct lock entry_num_lock;
-    int entry_num;
-    struct cache_entry cache_entrys[CACHE_SIZE];
+    struct lock lock;                   /* Guards the index and clock hand. */
+    struct condition unpinned;          /* Signaled when a REF_COUNT drops
+                                           to zero. */
+    struct hash index;                  /* Entries in use, by sector. */
+    int hand;                           /* Clock hand, an entry index. */
+    int dirty_cnt;                      /* Number of dirty entries. */
+    struct semaphore flush_wakeup;      /* Up'd to run the write-behind
+                                           thread. */
+    struct cache_entry **flush_list;    /* Write-behind scratch array. */
+    int entry_num;                      /* Entries handed out so far. */
+    int entry_cnt;                      /* Number of entries. */
+    struct cache_entry *cache_entrys;   /* Array of ENTRY_CNT entries. */
   };
 
 struct block_cache cache;
 
+/* Requested buffer cache size, in sectors.
+   Controlled by kernel command-line option "-cache=SECTORS". */
+size_t cache_size = CACHE_SIZE;
+
+/* Set by cache_wake_flusher(), cleared by the write-behind
+   thread.  Accessed with interrupts off. */
+static bool flush_requested;
+static bool flush_ready;
+
+static thread_func cache_flush_daemon NO_RETURN;
+
+/* Sectors queued for the read-ahead thread, in a ring buffer. */
+static block_sector_t read_ahead_queue[READ_AHEAD_QUEUE];
+static int read_ahead_head;             /* Index of the oldest sector. */
+static int read_ahead_cnt;              /* Number of queued sectors. */
+static struct lock read_ahead_lock;     /* Guards the queue. */
+static struct condition read_ahead_cond; /* Signaled when one is queued. */
+
+static thread_func cache_read_ahead_daemon NO_RETURN;
+
 block_sector_t read_sector (block_sector_t sector, off_t offset);
 
 void cache_write(struct block *block, const block_sector_t sector, void *data);
 void deallocate_inode(struct inode_disk *disk_inode);
+static size_t inode_fill (struct inode_disk *, block_sector_t home,
+                          size_t idx, size_t cnt, bool zero);
+static void inode_flush (struct inode *);
+static void inode_flush_all (void);
+
+/* Returns a hash value for the cache entry E. */
+static unsigned
+cache_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct cache_entry, hash_elem)->sector);
+}
+
+/* Returns true if cache entry A caches a lower sector than B. */
+static bool
+cache_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct cache_entry, hash_elem)->sector
+          < hash_entry (b, struct cache_entry, hash_elem)->sector);
+}
+
+/* Allocates CNT cache entries and their sector buffers from the
+   kernel pool.  Returns false, allocating nothing, if the pool
+   cannot supply that many pages. */
+static bool
+cache_alloc (size_t cnt)
+{
+  size_t entry_pages = DIV_ROUND_UP (cnt * sizeof *cache.cache_entrys, PGSIZE);
+  size_t data_pages = DIV_ROUND_UP (cnt, SECTORS_PER_PAGE);
+  uint8_t *data;
+  size_t i;
+
+  cache.cache_entrys = palloc_get_multiple (PAL_ZERO, entry_pages);
+  if (cache.cache_entrys == NULL)
+    return false;
+  cache.flush_list = malloc (cnt * sizeof *cache.flush_list);
+  data = palloc_get_multiple (0, data_pages);
+  if (data == NULL || cache.flush_list == NULL)
+    {
+      palloc_free_multiple (cache.cache_entrys, entry_pages);
+      palloc_free_multiple (data, data_pages);
+      free (cache.flush_list);
+      return false;
+    }
+
+  cache.entry_cnt = cnt;
+  for (i = 0; i < cnt; i++)
+    cache.cache_entrys[i].data = data + i * BLOCK_SECTOR_SIZE;
+  return true;
+}
 
 void cache_init()
 {
+  size_t cnt = cache_size > CACHE_MIN ? cache_size : CACHE_MIN;
+
+  /* Shrink the request until the kernel pool can hold it. */
+  while (!cache_alloc (cnt))
+    {
+      if (cnt == CACHE_MIN)
+        PANIC ("buffer cache allocation failed");
+      cnt = cnt / 2 > CACHE_MIN ? cnt / 2 : CACHE_MIN;
+    }
+  if (cnt != cache_size)
+    printf ("buffer cache: using %zu sectors instead of %zu\n",
+            cnt, cache_size);
+
   cache.entry_num = 0;
-  lock_init (&(cache.entry_num_lock));
+  lock_init (&cache.lock);
+  cond_init (&cache.unpinned);
+  if (!hash_init (&cache.index, cache_hash, cache_less, NULL))
+    PANIC ("buffer cache index creation failed");
+  cache.hand = 0;
+  cache.dirty_cnt = 0;
+  sema_init (&cache.flush_wakeup, 0);
   int i = 0;
-  for( i = 0; i < CACHE_SIZE; i++)
+  for( i = 0; i < cache.entry_cnt; i++)
     {
       cache.cache_entrys[i].sector = -1;
       cache.cache_entrys[i].ref_count = 0;
       lock_init(&(cache.cache_entrys[i].lock));
-      cache.cache_entrys[i].write = false;
+      cache.cache_entrys[i].accessed = false;
+      cache.cache_entrys[i].dirty = false;
     }
 }
 
-bool 
-cache_read(struct block *block, const block_sector_t sector, void *data)
+/* Wakes up the write-behind thread, unless it has already been
+   asked to run.  May be called from an interrupt handler. */
+static void
+cache_wake_flusher (void)
 {
-
-
-  (char*)data;
-  int i = 0;
-  bool found = false;
-  lock_acquire (&cache.entry_num_lock);
-  for ( i = 0; i < cache.entry_num; i++)
-    {
-      lock_acquire (&(cache.cache_entrys[i].lock));
-      if (cache.cache_entrys[i].sector == sector )
-      {
-        cache.cache_entrys[i].ref_count = 0;
-        memcpy (data, cache.cache_entrys[i].data, BLOCK_SECTOR_SIZE);
-        found = true;
-      }
-      else
-      {
-        cache.cache_entrys[i].ref_count+=1;
-      }
-      lock_release (&(cache.cache_entrys[i].lock));
-    }
-  lock_release (&cache.entry_num_lock);
-  if (found)
-  {
-    return found;
-  }
-  lock_acquire(&cache.entry_num_lock);
-  for (i = 0; i < cache.entry_num; i++)
+  enum intr_level old_level = intr_disable ();
+  if (flush_ready && !flush_requested)
     {
-      lock_acquire (&(cache.cache_entrys[i].lock));
-      cache.cache_entrys[i].ref_count -= 1;
-      lock_release (&(cache.cache_entrys[i].lock));
+      flush_requested = true;
+      sema_up (&cache.flush_wakeup);
     }
-  lock_release (&cache.entry_num_lock);
-  block_read (fs_device,sector,(void*)data);
-  cache_write (fs_device,sector,data);
-  return found;
+  intr_set_level (old_level);
+}
 
-  
+/* Called by the timer interrupt handler on every timer tick.
+   Periodically wakes up the write-behind thread. */
+void
+cache_tick (int64_t ticks)
+{
+  if (ticks % WRITE_BEHIND_TICKS == 0)
+    cache_wake_flusher ();
 }
 
-void 
-cache_read_bytes (struct block *block, const block_sector_t sector_idx, \
- void *buff, int offset, int size)
+/* Writes E back to disk if it is dirty and returns true, or
+   returns false if it is clean.  The caller must hold E's lock,
+   or cache.lock while E's REF_COUNT is zero, and must decrement
+   cache.dirty_cnt if this returns true. */
+static bool
+cache_write_back (struct cache_entry *e)
 {
-  uint8_t *bounce = NULL;
-  bounce = malloc(BLOCK_SECTOR_SIZE);
-  if(bounce == NULL)
-  {
-    bounce = malloc(BLOCK_SECTOR_SIZE);
-    if (bounce == NULL)
-      return;
-  }
-  cache_read (block, sector_idx, bounce);
-  memcpy (buff, bounce + offset, size);
-  free (bounce);
+  if (!e->dirty)
+    return false;
+  block_write (fs_device, e->sector, e->data);
+  e->dirty = false;
+  return true;
 }
 
-void 
-cache_write (struct block *block, const block_sector_t sector, void *data)
-{
-  (char*)data;
-  int i = 0; 
-  int replace = 0;
-  int max_index = 0, max = 0;
-  int found = 0;
-  
-  lock_acquire (&cache.entry_num_lock);
-  for ( i = 0; i < cache.entry_num; i++)
-  {
-    lock_acquire (&(cache.cache_entrys[i].lock));
-    if (cache.cache_entrys[i].sector == sector )
+/* Picks an entry to hold a new sector and removes it from the
+   index.  Unused entries are handed out first.  After that the
+   clock hand sweeps the entries, skipping those in use and giving
+   each recently accessed entry a second chance.  Clean entries
+   are preferred, leaving dirty ones to the write-behind thread;
+   only if every candidate is dirty is one written back here.
+   Returns a null pointer if every entry is pinned.
+   Must be called with cache.lock held. */
+static struct cache_entry *
+cache_evict (void)
+{
+  struct cache_entry *victim, *fallback;
+  int i;
+
+  ASSERT (lock_held_by_current_thread (&cache.lock));
+
+  if (cache.entry_num < cache.entry_cnt)
+    return &cache.cache_entrys[cache.entry_num++];
+
+  /* Two sweeps clear every ACCESSED bit, so if no entry turns up
+     by then, all of them are in use. */
+  fallback = NULL;
+  for (i = 0; i < 2 * cache.entry_cnt; i++)
     {
-      cache.cache_entrys[i].ref_count = 0;
-      found = 1;
-      replace = i;
+      victim = &cache.cache_entrys[cache.hand];
+      cache.hand = (cache.hand + 1) % cache.entry_cnt;
+      if (victim->ref_count > 0)
+        continue;
+      if (victim->accessed)
+        victim->accessed = false;
+      else if (!victim->dirty)
+        goto found;
+      else if (fallback == NULL)
+        fallback = victim;
     }
-    else
+  if (fallback == NULL)
+    return NULL;
+  victim = fallback;
+  cache_wake_flusher ();
+
+ found:
+  /* REF_COUNT is zero, so nobody else touches DATA. */
+  if (cache_write_back (victim))
+    cache.dirty_cnt--;
+  hash_delete (&cache.index, &victim->hash_elem);
+  return victim;
+}
+
+/* Pins the cache entry for SECTOR and returns it with its lock
+   held, so the caller may read or modify its DATA in place.  On a
+   miss, a new entry is set up and, if LOAD is true, filled from
+   disk; otherwise its data is left for the caller to overwrite.
+   The caller must release the entry with cache_release(). */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool load)
+{
+  struct cache_entry key;
+  struct cache_entry *e;
+  struct hash_elem *found;
+
+  lock_acquire (&cache.lock);
+  key.sector = sector;
+  for (;;)
     {
-      cache.cache_entrys[i].ref_count+=1;
-      if (cache.cache_entrys[i].ref_count > max)
-      {
-        max = cache.cache_entrys[i].ref_count;
-        max_index = i;
-      }
+      found = hash_find (&cache.index, &key.hash_elem);
+      if (found != NULL)
+        {
+          e = hash_entry (found, struct cache_entry, hash_elem);
+          e->accessed = true;
+          e->ref_count++;
+          lock_release (&cache.lock);
+
+          /* Waits out a concurrent fill of the same sector. */
+          lock_acquire (&e->lock);
+          return e;
+        }
+
+      e = cache_evict ();
+      if (e != NULL)
+        break;
+
+      /* Someone else may load SECTOR while we wait, so look it
+         up again afterward. */
+      cond_wait (&cache.unpinned, &cache.lock);
     }
-    lock_release (&(cache.cache_entrys[i].lock));
-  }
-  lock_release(&cache.entry_num_lock);
-  if (found)
-  {
-    lock_acquire (&(cache.cache_entrys[replace].lock));
-    cache.cache_entrys[replace].sector = sector;
-    cache.cache_entrys[replace].ref_count = 0;
-    cache.cache_entrys[replace].write = true;
-    memcpy (cache.cache_entrys[replace].data, data, BLOCK_SECTOR_SIZE);
-    lock_release (&(cache.cache_entrys[replace].lock));
-    return;
-  }
-  lock_acquire (&(cache.entry_num_lock));
-  if (cache.entry_num < CACHE_SIZE)
-  {
-    lock_acquire (&(cache.cache_entrys[cache.entry_num].lock));
-    cache.cache_entrys[cache.entry_num].sector = sector;
-    cache.cache_entrys[cache.entry_num].ref_count = 0;
-    cache.cache_entrys[cache.entry_num].write = true;
-    memcpy (cache.cache_entrys[cache.entry_num].data, data, BLOCK_SECTOR_SIZE);
-    lock_release (&(cache.cache_entrys[cache.entry_num].lock));
-    cache.entry_num+=1;
-  }
-  lock_release (&(cache.entry_num_lock));
-  if (cache.entry_num < CACHE_SIZE)
-  return;
 
-  lock_acquire(&(cache.entry_num_lock));
-  if (cache.entry_num == CACHE_SIZE)
-  {
-    lock_acquire (&(cache.cache_entrys[max_index].lock));
-    if (cache.cache_entrys[max_index].write)
+  e->sector = sector;
+  e->ref_count++;
+  e->accessed = true;
+  e->dirty = false;
+  hash_insert (&cache.index, &e->hash_elem);
+
+  /* Cannot block: REF_COUNT was zero. */
+  lock_acquire (&e->lock);
+  lock_release (&cache.lock);
+
+  if (load)
+    block_read (fs_device, sector, e->data);
+  return e;
+}
+
+/* Unpins cache entry E, obtained from cache_get().  DIRTY says
+   whether the caller modified its data. */
+static void
+cache_release (struct cache_entry *e, bool dirty)
+{
+  bool newly_dirty = dirty && !e->dirty;
+
+  if (dirty)
+    e->dirty = true;
+  lock_acquire (&cache.lock);
+  lock_release (&e->lock);
+  if (--e->ref_count == 0)
+    cond_signal (&cache.unpinned, &cache.lock);
+  if (newly_dirty
+      && ++cache.dirty_cnt * CACHE_DIRTY_RATIO > cache.entry_cnt)
+    cache_wake_flusher ();
+  lock_release (&cache.lock);
+}
+
+/* Unpins cache entry E after writing it back with
+   cache_write_back().  CLEANED is that function's result. */
+static void
+cache_release_clean (struct cache_entry *e, bool cleaned)
+{
+  lock_acquire (&cache.lock);
+  lock_release (&e->lock);
+  if (--e->ref_count == 0)
+    cond_signal (&cache.unpinned, &cache.lock);
+  if (cleaned)
+    cache.dirty_cnt--;
+  lock_release (&cache.lock);
+}
+
+/* Loads up to CNT consecutive sectors starting at SECTOR into
+   the cache with a single device request, stopping at the first
+   that is already cached or at CACHE_RUN_MAX sectors.  Returns
+   the number loaded. */
+static size_t
+cache_load_run (block_sector_t sector, size_t cnt)
+{
+  struct cache_entry *run[CACHE_RUN_MAX];
+  void *buffers[CACHE_RUN_MAX];
+  struct cache_entry key;
+  size_t n, i;
+
+  if (cnt > CACHE_RUN_MAX)
+    cnt = CACHE_RUN_MAX;
+
+  lock_acquire (&cache.lock);
+  for (n = 0; n < cnt; n++)
     {
-      block_write (fs_device,cache.cache_entrys[max_index].sector, \
-      cache.cache_entrys[max_index].data);
+      struct cache_entry *e;
+
+      key.sector = sector + n;
+      if (hash_find (&cache.index, &key.hash_elem) != NULL)
+        break;
+      e = cache_evict ();
+      if (e == NULL)
+        break;
+      e->sector = sector + n;
+      e->ref_count++;
+      e->accessed = true;
+      e->dirty = false;
+      hash_insert (&cache.index, &e->hash_elem);
+
+      /* Cannot block: REF_COUNT was zero. */
+      lock_acquire (&e->lock);
+      run[n] = e;
+      buffers[n] = e->data;
     }
-    cache.cache_entrys[max_index].sector = sector;
-    cache.cache_entrys[max_index].ref_count = 0;
-    cache.cache_entrys[max_index].write = true;
-    memcpy (cache.cache_entrys[max_index].data, data, BLOCK_SECTOR_SIZE);
-    lock_release (&(cache.cache_entrys[max_index].lock));
-  }
-  lock_release (&(cache.entry_num_lock));
+  lock_release (&cache.lock);
 
+  block_readv (fs_device, sector, buffers, n);
+  for (i = 0; i < n; i++)
+    cache_release (run[i], false);
+  return n;
 }
 
-bool 
-cache_write_bytes (struct block *block, const block_sector_t sector_idx,  \
-void *buffer, int sector_ofs, int chunk_size,int sector_left)
+/* Reads SECTOR into DATA, which must have room for
+   BLOCK_SECTOR_SIZE bytes, going through the buffer cache. */
+void
+cache_read (struct block *block UNUSED, const block_sector_t sector,
+            void *data)
 {
-  uint8_t *bounce = NULL;
-  bounce = malloc(BLOCK_SECTOR_SIZE);
-  if(bounce == NULL);
-  {
-    bounce = malloc(BLOCK_SECTOR_SIZE);
-    if (bounce == NULL)
-    return false;
-  }
-    
-  if(sector_ofs > 0 || chunk_size < sector_left)
-    cache_read(fs_device,sector_idx,bounce);
-  else
-    memset (bounce, 0, BLOCK_SECTOR_SIZE);
-  memcpy (bounce + sector_ofs, buffer, chunk_size);
-  cache_write (fs_device,sector_idx,bounce);
-  free (bounce);
-  return true;
+  struct cache_entry *e = cache_get (sector, true);
+  memcpy (data, e->data, BLOCK_SECTOR_SIZE);
+  cache_release (e, false);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes from DATA to SECTOR in the
+   buffer cache.  The sector reaches disk when it is evicted or
+   on cache_sync(). */
+void 
+cache_write (struct block *block UNUSED, const block_sector_t sector,
+             void *data)
+{
+  struct cache_entry *e = cache_get (sector, false);
+  memcpy (e->data, data, BLOCK_SECTOR_SIZE);
+  cache_release (e, true);
 }
 
+/* Writes every dirty cached sector, every open inode that has
+   changed, and the changed parts of the free map back to disk. */
 void 
-cache_sync ()
+cache_sync (void)
 {
   int i = 0;
-  lock_acquire(&cache.entry_num_lock);
-  for (i = 0; i < cache.entry_num ; i++)
+  int entry_num;
+
+  free_map_flush ();
+  inode_flush_all ();
+  lock_acquire (&cache.lock);
+  entry_num = cache.entry_num;
+  lock_release (&cache.lock);
+  for (i = 0; i < entry_num; i++)
   {
-    lock_acquire (&(cache.cache_entrys[i].lock));
-    block_write (fs_device,cache.cache_entrys[i].sector,cache.cache_entrys[i].data);
-    lock_release (&(cache.cache_entrys[i].lock));
+    struct cache_entry *e = &cache.cache_entrys[i];
+
+    lock_acquire (&cache.lock);
+    e->ref_count++;
+    lock_release (&cache.lock);
+
+    lock_acquire (&e->lock);
+    cache_release_clean (e, cache_write_back (e));
   }
-  lock_release (&cache.entry_num_lock);
-};
+}
 
+/* Orders cache entry pointers A and B by sector. */
+static int
+compare_sectors (const void *a_, const void *b_)
+{
+  const struct cache_entry *a = *(struct cache_entry *const *) a_;
+  const struct cache_entry *b = *(struct cache_entry *const *) b_;
 
-/* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
-static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos)
+  return a->sector < b->sector ? -1 : a->sector > b->sector;
+}
+
+/* Writes back the entries that are dirty, in sector order, so
+   the disk sees one sweep instead of scattered writes.  The
+   entries are pinned while they are written, so they cannot be
+   evicted in the meantime. */
+static void
+cache_flush (void)
 {
-  ASSERT (inode != NULL);
-  struct inode_disk disk_inode;
-  cache_read(fs_device, inode->sector, &disk_inode);
-  if (pos < disk_inode.length)
-  {
-    if (pos < 124 * BLOCK_SECTOR_SIZE)
-    {  
-      int direct_num = pos / BLOCK_SECTOR_SIZE;
-      block_sector_t rv = disk_inode.direct[direct_num];
-      return rv;
+  int cnt = 0;
+  int i;
+
+  lock_acquire (&cache.lock);
+  for (i = 0; i < cache.entry_num; i++)
+    {
+      struct cache_entry *e = &cache.cache_entrys[i];
+
+      /* DIRTY is only a hint here, since we don't hold E's lock;
+         cache_write_back() checks it again. */
+      if (e->dirty)
+        {
+          e->ref_count++;
+          cache.flush_list[cnt++] = e;
+        }
     }
-    else if (pos < (124 + 128) * BLOCK_SECTOR_SIZE)
+  lock_release (&cache.lock);
+
+  qsort (cache.flush_list, cnt, sizeof *cache.flush_list, compare_sectors);
+  for (i = 0; i < cnt; )
     {
-      int indirect_num = pos / BLOCK_SECTOR_SIZE - 124;
-      block_sector_t rv = read_sector(disk_inode.indirect, indirect_num); 
-      return rv;
+      struct cache_entry **run = &cache.flush_list[i];
+      const void *buffers[CACHE_RUN_MAX];
+      bool was_dirty[CACHE_RUN_MAX];
+      int n, j;
+
+      /* Write back each run of consecutive sectors as one
+         request.  Entries that were cleaned in the meantime are
+         rewritten with what the disk already has. */
+      for (n = 1; n < CACHE_RUN_MAX && i + n < cnt; n++)
+        if (run[n]->sector != run[0]->sector + n)
+          break;
+      for (j = 0; j < n; j++)
+        {
+          lock_acquire (&run[j]->lock);
+          buffers[j] = run[j]->data;
+          was_dirty[j] = run[j]->dirty;
+          run[j]->dirty = false;
+        }
+      block_writev (fs_device, run[0]->sector, buffers, n);
+      for (j = 0; j < n; j++)
+        cache_release_clean (run[j], was_dirty[j]);
+      i += n;
     }
-    else 
+}
+
+/* Write-behind thread.  Flushes dirty entries whenever the timer
+   or a rising dirty count wakes it up, so dirty data reaches disk
+   without anyone waiting on it. */
+static void
+cache_flush_daemon (void *aux UNUSED)
+{
+  for (;;)
     {
-      int doubly_indirect_num = (pos / BLOCK_SECTOR_SIZE - 124 - 128) / 128;
-      int inner_indirect_num = pos / BLOCK_SECTOR_SIZE - doubly_indirect_num;
-      block_sector_t inner_indirect_sector = read_sector(disk_inode.doubly_indirect, doubly_indirect_num);
-      return read_sector(inner_indirect_sector, inner_indirect_num);
+      enum intr_level old_level;
+
+      sema_down (&cache.flush_wakeup);
+      old_level = intr_disable ();
+      flush_requested = false;
+      intr_set_level (old_level);
+
+      cache_flush ();
     }
-  }
-  else
-    return -1;
 }
 
-/* Read the sector located at an offset.  For indirect and doubly indirect pointers only */ 
+/* Loads the CNT sectors starting at SECTOR into the cache,
+   skipping those already there. */
+static void
+cache_prefetch (block_sector_t sector, size_t cnt)
+{
+  size_t i, n;
 
-block_sector_t
-read_sector (block_sector_t sector, off_t offset)
+  for (i = 0; i < cnt; i += n > 0 ? n : 1)
+    n = cache_load_run (sector + i, cnt - i);
+}
+
+/* Queues SECTOR to be loaded into the cache by the read-ahead
+   thread.  Drops the request if the queue is full. */
+static void
+cache_read_ahead (block_sector_t sector)
 {
-  block_sector_t buffer[1];
-  off_t bytes_read = 0;
-  block_sector_t *bounce = NULL;
+  lock_acquire (&read_ahead_lock);
+  if (read_ahead_cnt < READ_AHEAD_QUEUE)
+    {
+      int tail = (read_ahead_head + read_ahead_cnt++) % READ_AHEAD_QUEUE;
+      read_ahead_queue[tail] = sector;
+      cond_signal (&read_ahead_cond, &read_ahead_lock);
+    }
+  lock_release (&read_ahead_lock);
+}
+
+/* Read-ahead thread.  Loads queued sectors into the cache, so
+   that a sequential reader finds them there. */
+static void
+cache_read_ahead_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      block_sector_t sector;
+      size_t cnt = 0;
+
+      /* Take the oldest sector along with any queued right after
+         it that follow it on disk, to load them together. */
+      lock_acquire (&read_ahead_lock);
+      while (read_ahead_cnt == 0)
+        cond_wait (&read_ahead_cond, &read_ahead_lock);
+      sector = read_ahead_queue[read_ahead_head];
+      do
+        {
+          read_ahead_head = (read_ahead_head + 1) % READ_AHEAD_QUEUE;
+          read_ahead_cnt--;
+          cnt++;
+        }
+      while (read_ahead_cnt > 0 && cnt < CACHE_RUN_MAX
+             && read_ahead_queue[read_ahead_head] == sector + cnt);
+      lock_release (&read_ahead_lock);
+
+      cache_prefetch (sector, cnt);
+    }
+}
+
+/* Returns the number of extents DISK_INODE is using. */
+static int
+extent_count (const struct inode_disk *disk_inode)
+{
+  int cnt = 0;
+
+  while (cnt < INODE_EXTENT_CNT && disk_inode->extents[cnt].length > 0)
+    cnt++;
+  return cnt;
+}
+
+/* Returns the sector holding the IDX'th sector of data in
+   extent-mapped DISK_INODE, or 0 if it falls in a hole. */
+static block_sector_t
+extent_to_sector (const struct inode_disk *disk_inode, size_t idx)
+{
+  int i;
+
+  for (i = 0; i < INODE_EXTENT_CNT; i++)
+    {
+      const struct inode_extent *x = &disk_inode->extents[i];
+      if (idx < x->length)
+        return x->start != 0 ? x->start + idx : 0;
+      idx -= x->length;
+    }
+  return 0;
+}
 
-  /* Disk sector to read, starting byte offset within sector. */
-  block_sector_t sector_idx = sector;
-  int sector_ofs = offset;
+/* Returns the sector holding the IDX'th sector of data in
+   INODE_MAGIC-layout DISK_INODE, or 0 if it falls in a hole. */
+static block_sector_t
+block_to_sector (const struct inode_disk *disk_inode, size_t idx)
+{
+  block_sector_t inner;
 
+  if (idx < 124)
+    return disk_inode->direct[idx];
 
-  /* Number of bytes to actually copy out of this sector. */
-  int chunk_size = 4;
+  idx -= 124;
+  if (idx < 128)
+    return (disk_inode->indirect != 0
+            ? read_sector (disk_inode->indirect, idx) : 0);
+
+  idx -= 128;
+  if (idx >= 128 * 128 || disk_inode->doubly_indirect == 0)
+    return 0;
+  inner = read_sector (disk_inode->doubly_indirect, idx / 128);
+  return inner != 0 ? read_sector (inner, idx % 128) : 0;
+}
 
-  /* Read sector into bounce buffer, then partially copy
-      into caller's buffer. */
-  if (bounce == NULL)
+/* Returns the block device sector that holds logical sector IDX
+   of INODE, or 0 if it is a hole, whether or not IDX lies within
+   INODE's length.  The caller must hold INODE's lock. */
+static block_sector_t
+idx_to_sector (struct inode *inode, size_t idx)
+{
+  const struct inode_disk *disk_inode = &inode->data;
+  struct inode_xlate *x;
+
+  if (disk_inode->magic == INODE_EXTENT_MAGIC)
+    return extent_to_sector (disk_inode, idx);
+  else if (idx < 124)
+    return disk_inode->direct[idx];
+
+  /* Past the direct pointers, look in INODE's translations
+     before walking the pointer blocks. */
+  x = &inode->xlate[idx % INODE_XLATE_CNT];
+  if (x->idx != idx)
     {
-      bounce = malloc (BLOCK_SECTOR_SIZE);
+      x->idx = idx;
+      x->sector = block_to_sector (disk_inode, idx);
     }
-  cache_read (fs_device, sector_idx, bounce);
-  memcpy (buffer, bounce + sector_ofs, 4);
+  return x->sector;
+}
 
-  free (bounce);
-  block_sector_t new_sector = buffer[0];
+/* Returns the block device sector that contains byte offset POS
+   within INODE.
+   Returns -1 if INODE does not contain data for a byte at offset
+   POS, or 0 if that byte lies in a hole that reads as zeros.
+   The caller must hold INODE's lock. */
+static block_sector_t
+byte_to_sector (struct inode *inode, off_t pos)
+{
+  ASSERT (inode != NULL);
+  if (pos >= inode->data.length)
+    return -1;
+  return idx_to_sector (inode, pos / BLOCK_SECTOR_SIZE);
+}
+
+/* Forgets INODE's remembered block-map translations, after its
+   block map changes.  The caller must hold INODE's lock. */
+static void
+inode_xlate_clear (struct inode *inode)
+{
+  memset (inode->xlate, 0, sizeof inode->xlate);
+}
 
+/* Returns the OFFSET'th sector number stored in pointer block
+   SECTOR.  For indirect and doubly indirect pointers only. */
+block_sector_t
+read_sector (block_sector_t sector, off_t offset)
+{
+  struct cache_entry *e = cache_get (sector, true);
+  block_sector_t new_sector = ((block_sector_t *) e->data)[offset];
+  cache_release (e, false);
   return new_sector;
 }
 
-/* List of open inodes, so that opening a single inode twice
+/* Stores VALUE as the OFFSET'th sector number in pointer block
+   SECTOR.  If FRESH, SECTOR was just allocated and the rest of
+   it is zeroed instead of being read. */
+static void
+write_sector (block_sector_t sector, off_t offset, block_sector_t value,
+              bool fresh)
+{
+  struct cache_entry *e = cache_get (sector, !fresh);
+  if (fresh)
+    memset (e->data, 0, BLOCK_SECTOR_SIZE);
+  ((block_sector_t *) e->data)[offset] = value;
+  cache_release (e, true);
+}
+
+/* Open inodes, by sector, so that opening a single inode twice
    returns the same `struct inode'. */
-static struct list open_inodes;
+static struct hash open_inodes;
+
+/* Guards open_inodes and the OPEN_CNT of every inode in it.  May
+   be acquired while holding free_map_lock, but not the other way
+   around. */
+static struct lock open_inodes_lock;
+
+/* Returns a hash value for open inode E. */
+static unsigned
+open_inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+/* Returns true if open inode A is at a lower sector than B. */
+static bool
+open_inode_less (const struct hash_elem *a, const struct hash_elem *b,
+                 void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void)
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, open_inode_hash, open_inode_less, NULL))
+    PANIC ("open inode table creation failed");
+  lock_init (&open_inodes_lock);
   cache_init();
+
+  flush_ready = true;
+  if (thread_create ("write-behind", PRI_DEFAULT, cache_flush_daemon, NULL)
+      == TID_ERROR)
+    PANIC ("can't start write-behind thread");
+
+  lock_init (&read_ahead_lock);
+  cond_init (&read_ahead_cond);
+  if (thread_create ("read-ahead", PRI_DEFAULT, cache_read_ahead_daemon, NULL)
+      == TID_ERROR)
+    PANIC ("can't start read-ahead thread");
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -356,96 +849,22 @@ inode_create (block_sector_t sector, off_t length)
   if (disk_inode != NULL)
     {
       size_t sectors = bytes_to_sectors (length);
-      int sector_count = (int) length / BLOCK_SECTOR_SIZE;
-      if (sector_count * BLOCK_SECTOR_SIZE < length) 
-        ++sector_count;
+      size_t done = 0;
+      size_t n;
+
+      /* Files are created fully allocated; only later growth
+         leaves holes. */
+      disk_inode->magic = INODE_EXTENT_MAGIC;
+      while (done < sectors
+             && (n = inode_fill (disk_inode, sector, done, sectors - done,
+                                 true)) > 0)
+        done += n;
       disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
-
-      // Allocate direct inodes
-      static char zeros[BLOCK_SECTOR_SIZE];
-      memset(zeros, 0, BLOCK_SECTOR_SIZE);
-
-      int j;
-      for (j = 0; j < sector_count && j < 124; j++) 
-        {
-        if (free_map_allocate (1, &disk_inode->direct[j]))
-          {
-            cache_write (fs_device, disk_inode->direct[j], zeros);
-            success = true;
-          }
-        }
-
-      // Allocate indirect inode
-      if (sector_count > 124)
-        {
-          if (free_map_allocate (1, &disk_inode->indirect))
-          {
-
-            block_sector_t indirect_blocks[128];
-
-            // Fill indirect inode
-            for (j = 0; j < 128 && j < sector_count - 124; j++) 
-              {
-              if (free_map_allocate (1, &indirect_blocks[j])) 
-                {
-                  cache_write (fs_device, indirect_blocks[j], zeros);
-                }
-              }
-
-            // Cache indirect inode
-            cache_write (fs_device, disk_inode->indirect, indirect_blocks);
-            success = true;
-          }
-        }
-
-      // Allocate doubly indirect inode
-      if (sector_count > 124 + 128)
-        {
-          if (free_map_allocate (1, &disk_inode->doubly_indirect))
-          {
-
-            block_sector_t doubly_indirect_blocks[128];
-
-            int sectors_left = sector_count - 124 - 128;
-
-            // Fill doubly indirect inode
-            for (j = 0; j < 128 && sectors_left > 0; j++) 
-              {
-              if (free_map_allocate (1, &doubly_indirect_blocks[j])) 
-                {
-                  block_sector_t inner_doubly_indirect_blocks[128];
-
-                  // Fill inner doubly indirect inode
-                  int k;
-                  for (k = 0; k < 128 && sectors_left > 0; k++) 
-                    {
-                    if (free_map_allocate (1, &inner_doubly_indirect_blocks[k])) 
-                      {
-                        cache_write (fs_device, inner_doubly_indirect_blocks[k], zeros);
-                      }
-                    sectors_left -= 1;
-                    }
-
-                  // Cache inner doubly indirect inode
-                  cache_write (fs_device, doubly_indirect_blocks[k], inner_doubly_indirect_blocks);
-                }
-              }
-
-            // Cache doubly indirect inode
-              cache_write (fs_device, disk_inode->doubly_indirect, doubly_indirect_blocks);
-            success = true;
-          }
-        }
-      if (sector_count > 0) 
-      {
-        cache_write (fs_device, sector, disk_inode);   
-      }
+      success = done == sectors;
+      if (success)
+        cache_write (fs_device, sector, disk_inode);
       else
-      {
-        cache_write (fs_device, sector, disk_inode);   
-        success = true;
-      }
+        deallocate_inode (disk_inode);
       free (disk_inode);
     }
   return success;
@@ -459,32 +878,43 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
 
+  lock_acquire (&open_inodes_lock);
+
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e))
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector)
-        {
-          inode_reopen (inode);
-          return inode;
-        }
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+      return inode;
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize.  The disk inode is read before the inode becomes
+     visible to other openers. */
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
+  lock_init (&inode->lock);
+  cache_read (fs_device, inode->sector, &inode->data);
+  inode->dirty = false;
+  inode_xlate_clear (inode);
+  hash_insert (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -493,7 +923,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -515,89 +949,121 @@ inode_close (struct inode *inode)
     return;
 
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  lock_acquire (&open_inodes_lock);
+  if (--inode->open_cnt > 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
+      lock_release (&open_inodes_lock);
+      return;
+    }
 
-      /* Deallocate blocks if removed. */
-      if (inode->removed)
-        {
-          struct inode_disk disk_inode;
-          cache_read(fs_device, inode->sector, &disk_inode);
-          deallocate_inode(&disk_inode);
-          free_map_release (inode->sector, 1);
-          // free_map_release (inode->data.direct[0],
-                            // bytes_to_sectors (inode->data.length));
-        }
+  /* A surviving inode is written back before it leaves the table,
+     so that a concurrent inode_open() cannot read a stale copy
+     from the cache. */
+  if (!inode->removed)
+    inode_flush (inode);
+  hash_delete (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+
+  /* Deallocate blocks if removed.  This takes free_map_lock, so
+     it must happen after releasing open_inodes_lock. */
+  if (inode->removed)
+    {
+      deallocate_inode(&inode->data);
+      free_map_release (inode->sector, 1);
+    }
+
+  free (inode);
+}
 
-      free (inode);
+/* Writes INODE's in-memory copy of its disk inode into the
+   buffer cache, if it has changed since it was last written. */
+static void
+inode_flush (struct inode *inode)
+{
+  lock_acquire (&inode->lock);
+  if (inode->dirty)
+    {
+      cache_write (fs_device, inode->sector, &inode->data);
+      inode->dirty = false;
     }
+  lock_release (&inode->lock);
 }
 
-void
-deallocate_inode(struct inode_disk *disk_inode)
+/* Writes back every open inode that has changed. */
+static void
+inode_flush_all (void)
 {
-  int old_length = disk_inode->length;
-  int total_sectors = old_length / BLOCK_SECTOR_SIZE;
-  if (total_sectors * BLOCK_SECTOR_SIZE < old_length) 
-    ++total_sectors;
-  int remaining_sectors = total_sectors;
+  struct hash_iterator i;
 
-  static char zeros[BLOCK_SECTOR_SIZE];
-  memset(zeros, 0, BLOCK_SECTOR_SIZE);
+  lock_acquire (&open_inodes_lock);
+  hash_first (&i, &open_inodes);
+  while (hash_next (&i))
+    inode_flush (hash_entry (hash_cur (&i), struct inode, elem));
+  lock_release (&open_inodes_lock);
+}
 
-  if (total_sectors <= 0) 
-  {
-    return;
-  }
-      
-  // Deallocate direct inodes
-  int j;
-  for (j = 0; j < total_sectors && j < 124; j++) 
-  {
-    free_map_release(disk_inode->direct[j], 1);
-    remaining_sectors = remaining_sectors - 1;
-  }
+/* Releases the first CNT sectors listed in pointer block SECTOR,
+   skipping holes. */
+static void
+release_pointers (block_sector_t sector, size_t cnt)
+{
+  block_sector_t blocks[128];
+  size_t i;
 
-  if (remaining_sectors > 0)
+  cache_read (fs_device, sector, blocks);
+  for (i = 0; i < cnt && i < 128; i++)
+    if (blocks[i] != 0)
+      free_map_release (blocks[i], 1);
+}
+
+/* Releases every sector DISK_INODE's data and pointer blocks
+   occupy, including any past its length that inode_shrink()
+   left mapped.  The inode's own sector is left alone. */
+void
+deallocate_inode(struct inode_disk *disk_inode)
+{
+  size_t remaining = INODE_BLOCK_CNT;
+  size_t j;
+
+  if (disk_inode->magic == INODE_EXTENT_MAGIC)
     {
-      block_sector_t indirect_blocks[128]; 
-      cache_read(fs_device, &disk_inode->indirect, indirect_blocks);
-      int j = 0;
-      for (j = 0; j < 128 && remaining_sectors > 0; j++) 
-        {
-        free_map_release(indirect_blocks[j], 1);
-        remaining_sectors -= 1;
-        }
-      free_map_release(disk_inode->indirect, 1);
+      int i;
+      for (i = 0; i < extent_count (disk_inode); i++)
+        if (disk_inode->extents[i].start != 0)
+          free_map_release (disk_inode->extents[i].start,
+                            disk_inode->extents[i].length);
+      return;
     }
 
-  if (remaining_sectors > 0)
-  {
-
-    block_sector_t doubly_indirect_blocks[128];
-    cache_read(fs_device, &disk_inode->doubly_indirect, doubly_indirect_blocks);
+  // Deallocate direct blocks
+  for (j = 0; j < 124 && j < remaining; j++)
+    if (disk_inode->direct[j] != 0)
+      free_map_release (disk_inode->direct[j], 1);
+  remaining = remaining > 124 ? remaining - 124 : 0;
 
-    int j = 0;
-    for (j = 0; j < 128 && remaining_sectors > 0; j++) 
+  // Deallocate indirect block
+  if (remaining > 0 && disk_inode->indirect != 0)
     {
+      release_pointers (disk_inode->indirect, remaining);
+      free_map_release (disk_inode->indirect, 1);
+    }
+  remaining = remaining > 128 ? remaining - 128 : 0;
 
-      block_sector_t inner_doubly_indirect_blocks[128];
-      cache_read(fs_device, doubly_indirect_blocks[j], inner_doubly_indirect_blocks);
+  // Deallocate doubly indirect block
+  if (remaining > 0 && disk_inode->doubly_indirect != 0)
+    {
+      block_sector_t doubly_indirect_blocks[128];
 
-      int k;
-      for (k = 0; k < 128 && remaining_sectors > 0; k++) 
-      {
-        free_map_release(inner_doubly_indirect_blocks[k], 1);
-        remaining_sectors -= 1;
-      }
-      free_map_release(doubly_indirect_blocks[j], 1);
+      cache_read (fs_device, disk_inode->doubly_indirect,
+                  doubly_indirect_blocks);
+      for (j = 0; j < 128 && j * 128 < remaining; j++)
+        if (doubly_indirect_blocks[j] != 0)
+          {
+            release_pointers (doubly_indirect_blocks[j], remaining - j * 128);
+            free_map_release (doubly_indirect_blocks[j], 1);
+          }
+      free_map_release (disk_inode->doubly_indirect, 1);
     }
-    free_map_release(disk_inode->doubly_indirect, 1);
-          
-  }
-  return;
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -609,38 +1075,131 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+/* Returns the total length of the CNT buffers in IOV. */
+static off_t
+iov_size (const struct iovec *iov, int cnt)
+{
+  off_t size = 0;
+  int i;
+
+  for (i = 0; i < cnt; i++)
+    size += iov[i].iov_len;
+  return size;
+}
+
+/* Copies SIZE bytes to DST from the buffers at *IOV, starting
+   *OFS bytes into the first, and advances *IOV and *OFS past
+   them. */
+static void
+iov_gather (uint8_t *dst, const struct iovec **iov, size_t *ofs, size_t size)
+{
+  while (size > 0)
+    {
+      size_t chunk = (*iov)->iov_len - *ofs;
+      if (chunk > size)
+        chunk = size;
+      memcpy (dst, (uint8_t *) (*iov)->iov_base + *ofs, chunk);
+      dst += chunk;
+      size -= chunk;
+      *ofs += chunk;
+      if (*ofs == (*iov)->iov_len)
+        {
+          (*iov)++;
+          *ofs = 0;
+        }
+    }
+}
+
+/* Copies SIZE bytes from SRC, or SIZE zeros if SRC is null, to
+   the buffers at *IOV, starting *OFS bytes into the first, and
+   advances *IOV and *OFS past them. */
+static void
+iov_scatter (const uint8_t *src, const struct iovec **iov, size_t *ofs,
+             size_t size)
+{
+  while (size > 0)
+    {
+      size_t chunk = (*iov)->iov_len - *ofs;
+      uint8_t *dst = (uint8_t *) (*iov)->iov_base + *ofs;
+      if (chunk > size)
+        chunk = size;
+      if (src != NULL)
+        {
+          memcpy (dst, src, chunk);
+          src += chunk;
+        }
+      else
+        memset (dst, 0, chunk);
+      size -= chunk;
+      *ofs += chunk;
+      if (*ofs == (*iov)->iov_len)
+        {
+          (*iov)++;
+          *ofs = 0;
+        }
+    }
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
 off_t
-inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
+inode_read_at (struct inode *inode, void *buffer, off_t size, off_t offset)
 {
-  uint8_t *buffer = buffer_;
+  struct iovec iov;
+
+  iov.iov_base = buffer;
+  iov.iov_len = size;
+  return inode_readv_at (inode, &iov, 1, offset);
+}
+
+/* Reads from INODE, starting at position OFFSET, into the CNT
+   buffers in IOV in turn, filling each before going on to the
+   next, in one pass over the sectors they span.
+   Returns the number of bytes actually read, which may be less
+   than the buffers' total length if an error occurs or end of
+   file is reached. */
+off_t
+inode_readv_at (struct inode *inode, const struct iovec *iov, int cnt,
+                off_t offset)
+{
+  off_t size = iov_size (iov, cnt);
+  size_t iov_ofs = 0;           /* Offset into *IOV. */
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  off_t run_end = 0;            /* End of the last run loaded below. */
 
   if (inode->sector > 20000000)
     return -1;
-  struct inode_disk disk_inode;
-
-  cache_read(fs_device, inode->sector, &disk_inode);
-
-  if (offset >= disk_inode.length)
-  {
-    static char zeros[BLOCK_SECTOR_SIZE];
-    memset(zeros, 0, BLOCK_SECTOR_SIZE);
-    memcpy (buffer + bytes_read, zeros, size);
-  }
-
 
   while (size > 0)
     {
-      /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      /* Disk sector to read, starting byte offset within sector.
+         When the read goes on past this sector, find how many of
+         the following sectors come next on disk too, so a run of
+         them can be loaded with one request. */
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      size_t run = 1;
+      lock_acquire (&inode->lock);
+      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      off_t length = inode->data.length;
+      if (sector_idx != 0 && offset >= run_end)
+        {
+          off_t end = offset + size < length ? offset + size : length;
+          off_t pos = offset - sector_ofs + BLOCK_SECTOR_SIZE;
+          while (run < CACHE_RUN_MAX && pos < end
+                 && byte_to_sector (inode, pos) == sector_idx + run)
+            {
+              run++;
+              pos += BLOCK_SECTOR_SIZE;
+            }
+          run_end = pos;
+        }
+      lock_release (&inode->lock);
+      if (run > 1)
+        cache_load_run (sector_idx, run);
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      off_t inode_left = length - offset;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -649,17 +1208,15 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          cache_read (fs_device, sector_idx, buffer + bytes_read);
-        }
+      /* Copy straight out of the cached sector.  Holes read as
+         zeros without touching the disk. */
+      if (sector_idx == 0)
+        iov_scatter (NULL, &iov, &iov_ofs, chunk_size);
       else
         {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          cache_read_bytes(fs_device, sector_idx, \
-          buffer + bytes_read, sector_ofs,chunk_size);
+          struct cache_entry *e = cache_get (sector_idx, true);
+          iov_scatter (e->data + sector_ofs, &iov, &iov_ofs, chunk_size);
+          cache_release (e, false);
         }
 
       /* Advance. */
@@ -667,203 +1224,479 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
   return bytes_read;
 }
 
-/* Adds necessary pointers to inode to make it have the correct new file size*/
-
+/* Asks the read-ahead thread to bring the sectors holding bytes
+   OFFSET through OFFSET + SIZE of INODE into the cache, stopping
+   at end of file.  Returns without waiting for them. */
 void
-add_inode (struct inode_disk *disk_inode, off_t new_length) 
+inode_read_ahead (struct inode *inode, off_t offset, off_t size)
 {
-  int old_length = disk_inode->length;
-  int total_sectors = new_length / BLOCK_SECTOR_SIZE;
-  if (total_sectors * BLOCK_SECTOR_SIZE < new_length) 
-    ++total_sectors;
+  off_t pos;
 
-  int current_sectors = old_length / BLOCK_SECTOR_SIZE;
-  if (current_sectors * BLOCK_SECTOR_SIZE < old_length) 
-    ++current_sectors;  
+  for (pos = offset - offset % BLOCK_SECTOR_SIZE; pos < offset + size;
+       pos += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector;
 
-  int new_sectors = total_sectors - current_sectors;
+      lock_acquire (&inode->lock);
+      sector = byte_to_sector (inode, pos);
+      lock_release (&inode->lock);
+      if (sector == (block_sector_t) -1)
+        break;
+      if (sector != 0)
+        cache_read_ahead (sector);
+    }
+}
 
+/* Zeroes CNT sectors starting at SECTOR. */
+static void
+zero_sectors (block_sector_t sector, size_t cnt)
+{
+  size_t i;
 
-  static char zeros[BLOCK_SECTOR_SIZE];
-  memset(zeros, 0, BLOCK_SECTOR_SIZE);
+  for (i = 0; i < cnt; i++)
+    {
+      struct cache_entry *e = cache_get (sector + i, false);
+      memset (e->data, 0, BLOCK_SECTOR_SIZE);
+      cache_release (e, true);
+    }
+}
 
-  if (new_sectors <= 0) 
-  {
-    if (new_length > old_length)
-      old_length = new_length;
-    disk_inode->length = old_length;
-    return;
-  }
+/* Returns the number of pointer blocks the INODE_MAGIC layout
+   needs to map SECTORS sectors. */
+static size_t
+pointer_blocks (size_t sectors)
+{
+  if (sectors <= 124)
+    return 0;
+  else if (sectors <= 124 + 128)
+    return 1;
+  else
+    return 2 + DIV_ROUND_UP (sectors - 124 - 128, 128);
+}
+
+/* Records SECTOR as the IDX'th sector of INODE_MAGIC-layout
+   DISK_INODE, whose sectors before IDX are already mapped.
+   Pointer blocks it needs are taken in order from *PTRS. */
+static void
+map_block (struct inode_disk *disk_inode, size_t idx, block_sector_t sector,
+           const block_sector_t **ptrs)
+{
+  block_sector_t inner;
 
-  if (current_sectors < 124)
+  if (idx < 124)
     {
-    if (total_sectors > 124)
-      new_sectors -= 124 - current_sectors;
-    else 
-      new_sectors = 0;
-      
-    // Allocate direct inodes
-    int j;
-    for (j = current_sectors; j < total_sectors && j < 124; j++) 
-      {
-      if (free_map_allocate (1, &disk_inode->direct[j]))
-        {
-          cache_write (fs_device, disk_inode->direct[j], zeros);
-        }
-      current_sectors = current_sectors + 1;
-      }
+      disk_inode->direct[idx] = sector;
+      return;
     }
 
-  if (new_sectors > 0 && current_sectors < 124 + 128)
+  idx -= 124;
+  if (idx < 128)
     {
-      if (total_sectors > 124 + 128)
-        new_sectors -= 128 - current_sectors;
-      else 
-        new_sectors = 0;
-      block_sector_t indirect_blocks[128];
+      if (idx == 0)
+        disk_inode->indirect = *(*ptrs)++;
+      write_sector (disk_inode->indirect, idx, sector, idx == 0);
+      return;
+    }
 
-      if (current_sectors == 124)
-      {
-        free_map_allocate (1, &disk_inode->indirect);
-      }
-      else
+  idx -= 128;
+  if (idx == 0)
+    disk_inode->doubly_indirect = *(*ptrs)++;
+  if (idx % 128 == 0)
+    {
+      inner = *(*ptrs)++;
+      write_sector (disk_inode->doubly_indirect, idx / 128, inner, idx == 0);
+    }
+  else
+    inner = read_sector (disk_inode->doubly_indirect, idx / 128);
+  write_sector (inner, idx % 128, sector, idx % 128 == 0);
+}
+
+/* Converts extent-mapped DISK_INODE to the INODE_MAGIC layout,
+   for a file too fragmented to grow within INODE_EXTENT_CNT
+   extents.  Holes stay holes.  Returns false, leaving DISK_INODE
+   unchanged, if it maps more sectors than that layout can, or
+   if memory or the pointer blocks cannot be allocated. */
+static bool
+extents_to_blocks (struct inode_disk *disk_inode)
+{
+  int cnt = extent_count (disk_inode);
+  struct inode_extent *extents;
+  block_sector_t *ptrs = NULL;
+  const block_sector_t *next_ptr;
+  size_t mapped, ptr_cnt, idx, i;
+  int x;
+
+  mapped = 0;
+  for (x = 0; x < cnt; x++)
+    mapped += disk_inode->extents[x].length;
+  if (mapped > INODE_BLOCK_CNT)
+    return false;
+  ptr_cnt = pointer_blocks (mapped);
+
+  extents = malloc (sizeof disk_inode->extents);
+  if (ptr_cnt > 0)
+    ptrs = malloc (ptr_cnt * sizeof *ptrs);
+  if (extents == NULL || (ptr_cnt > 0 && ptrs == NULL))
+    {
+      free (extents);
+      free (ptrs);
+      return false;
+    }
+  for (i = 0; i < ptr_cnt; i++)
+    if (!free_map_allocate (1, &ptrs[i]))
       {
-        cache_read(fs_device, disk_inode->indirect, indirect_blocks);
+        while (i-- > 0)
+          free_map_release (ptrs[i], 1);
+        free (extents);
+        free (ptrs);
+        return false;
       }
 
-      // Fill indirect inode
-      int j = 0;
-      for (j = current_sectors; j < 128 + 124 && j < total_sectors; j++) 
-        {
-        if (free_map_allocate (1, &indirect_blocks[j - 124])) 
-          {
-            cache_write (fs_device, indirect_blocks[j - 124], zeros);
-          }
-        current_sectors += 1;
-        }
+  memcpy (extents, disk_inode->extents, sizeof disk_inode->extents);
+  memset (disk_inode->extents, 0, sizeof disk_inode->extents);
+  disk_inode->magic = INODE_MAGIC;
 
+  idx = 0;
+  next_ptr = ptrs;
+  for (x = 0; x < cnt; x++)
+    for (i = 0; i < extents[x].length; i++)
+      map_block (disk_inode, idx++,
+                 extents[x].start != 0 ? extents[x].start + i : 0,
+                 &next_ptr);
 
-      // Cache indirect inode
-      cache_write (fs_device, disk_inode->indirect, indirect_blocks);
-    }
+  free (extents);
+  free (ptrs);
+  return true;
+}
+
+/* Allocates a zeroed pointer block and stores its sector in
+   *SECTORP.  Returns false if the disk is full. */
+static bool
+new_pointer_block (block_sector_t *sectorp)
+{
+  if (!free_map_allocate (1, sectorp))
+    return false;
+  zero_sectors (*sectorp, 1);
+  return true;
+}
 
-  if (new_sectors > 0)
+/* Records SECTOR as the IDX'th sector of INODE_MAGIC-layout
+   DISK_INODE, allocating any pointer blocks that are missing.
+   Returns false if the disk is full or IDX is beyond the largest
+   file the layout can map. */
+static bool
+block_set (struct inode_disk *disk_inode, size_t idx, block_sector_t sector)
+{
+  block_sector_t inner;
+
+  if (idx < 124)
     {
+      disk_inode->direct[idx] = sector;
+      return true;
+    }
 
-            block_sector_t doubly_indirect_blocks[128];
+  idx -= 124;
+  if (idx < 128)
+    {
+      if (disk_inode->indirect == 0
+          && !new_pointer_block (&disk_inode->indirect))
+        return false;
+      write_sector (disk_inode->indirect, idx, sector, false);
+      return true;
+    }
 
-            if (current_sectors == 124 + 128)
-            {
-              free_map_allocate (1, &disk_inode->doubly_indirect);
-              cache_read(fs_device, zeros, doubly_indirect_blocks);
-            }
-            else
-            {
-              cache_read(fs_device, disk_inode->doubly_indirect, doubly_indirect_blocks);
-            }
+  idx -= 128;
+  if (idx >= 128 * 128)
+    return false;
+  if (disk_inode->doubly_indirect == 0
+      && !new_pointer_block (&disk_inode->doubly_indirect))
+    return false;
+  inner = read_sector (disk_inode->doubly_indirect, idx / 128);
+  if (inner == 0)
+    {
+      if (!new_pointer_block (&inner))
+        return false;
+      write_sector (disk_inode->doubly_indirect, idx / 128, inner, false);
+    }
+  write_sector (inner, idx % 128, sector, false);
+  return true;
+}
 
-            int outer_start = (current_sectors - 124 - 128) / 128;
-            int inner_start = (current_sectors - 124 - 128) % 128;
+/* Allocates sectors for up to WANT holes in INODE_MAGIC-layout
+   DISK_INODE, starting with the hole at logical sector IDX and
+   stopping at the first sector already allocated.  Each sector
+   goes right after the one before it if that one is free, or as
+   close after it as possible; the first sector of a file goes
+   near its inode, in sector HOME.
+   Returns the number of sectors allocated. */
+static size_t
+block_fill (struct inode_disk *disk_inode, block_sector_t home, size_t idx,
+            size_t want, bool zero)
+{
+  block_sector_t prev = idx > 0 ? block_to_sector (disk_inode, idx - 1) : 0;
+  size_t n;
 
-            // Fill doubly indirect inode
-            int j = 0;
-            for (j = outer_start; j < 128 && new_sectors > 0; j++) 
-              {
+  for (n = 0; n < want; n++, idx++)
+    {
+      block_sector_t sector;
 
-                block_sector_t inner_doubly_indirect_blocks[128];
+      if (block_to_sector (disk_inode, idx) != 0)
+        break;
+      if (prev != 0 && free_map_allocate_at (prev + 1, 1) == 1)
+        sector = prev + 1;
+      else if (!free_map_allocate_near (prev != 0 ? prev + 1 : home + 1, 1,
+                                        &sector))
+        break;
+      if (!block_set (disk_inode, idx, sector))
+        {
+          free_map_release (sector, 1);
+          break;
+        }
+      if (zero)
+        zero_sectors (sector, 1);
+      prev = sector;
+    }
+  return n;
+}
 
-                if (current_sectors == 124 + 128 + 128 * j)
-                {
-                  free_map_allocate (1, &doubly_indirect_blocks[j]);                
-                }
-                else
-                {
-                  cache_read(fs_device, doubly_indirect_blocks[j], inner_doubly_indirect_blocks);
-                }
+/* Allocates sectors for up to WANT holes in extent-mapped
+   DISK_INODE, starting with the hole at logical sector IDX and
+   stopping at the end of that hole.  The extent before the hole
+   is extended in place while the sectors after it are free;
+   otherwise a new extent starts at the first free run at or
+   after the end of the file's last extent before the hole, or
+   after its inode, in sector HOME.  A DISK_INODE without room for the extents this might
+   need is first converted to the INODE_MAGIC layout.
+   Returns the number of sectors allocated, 0 if the disk is
+   full. */
+static size_t
+extent_fill (struct inode_disk *disk_inode, block_sector_t home, size_t idx,
+             size_t want, bool zero)
+{
+  struct inode_extent *x = disk_inode->extents;
+  struct inode_extent pieces[3];
+  struct inode_extent *prev;
+  bool merged = false;
+  int old_cnt, cnt, i, k;
+  block_sector_t start = 0;
+  size_t base, gap, n;
+
+  /* Find the hole extent holding IDX, or the end of the list. */
+  cnt = old_cnt = extent_count (disk_inode);
+  for (i = 0, base = 0; i < cnt && idx >= base + x[i].length; i++)
+    base += x[i].length;
+  ASSERT (i == cnt || x[i].start == 0);
+  gap = idx - base;
+  if (i < cnt && want > x[i].length - gap)
+    want = x[i].length - gap;
+
+  /* Filling the hole may split it in three, and filling past the
+     end may need a hole extent plus a new one. */
+  if (cnt + (gap > 0) + 1 > INODE_EXTENT_CNT)
+    {
+      if (!extents_to_blocks (disk_inode))
+        return 0;
+      return block_fill (disk_inode, home, idx, want, zero);
+    }
 
-                  // Fill inner doubly indirect inode
-                  int k;
-                  for (k = inner_start; k < 128 && new_sectors > 0; k++) 
-                    {
-                    inner_start = 0;
-                    if (free_map_allocate (1, &inner_doubly_indirect_blocks[k])) 
-                      {
-                        cache_write (fs_device, inner_doubly_indirect_blocks[k], zeros);
-                      }
-                    new_sectors -= 1;
-                    }
+  prev = gap == 0 && i > 0 && x[i - 1].start != 0 ? &x[i - 1] : NULL;
+  n = 0;
+  if (prev != NULL)
+    {
+      start = prev->start + prev->length;
+      n = free_map_allocate_at (start, want);
+      prev->length += n;
+      merged = n > 0;
+    }
+  if (n == 0)
+    {
+      block_sector_t goal = home + 1;
+      int j;
 
-                  // Cache inner doubly indirect inode
-                  cache_write (fs_device, doubly_indirect_blocks[j], inner_doubly_indirect_blocks);
-              }
+      for (j = i - 1; j >= 0; j--)
+        if (x[j].start != 0)
+          {
+            goal = x[j].start + x[j].length;
+            break;
+          }
+      n = free_map_allocate_near (goal, want, &start);
+      if (n == 0)
+        return 0;
+    }
 
-            // Cache doubly indirect inode
-              cache_write (fs_device, disk_inode->doubly_indirect, doubly_indirect_blocks);
-          
+  /* Replace the hole, or the end of the list, with what is left
+     of the hole before the new sectors, the new sectors unless
+     they joined PREV, and what is left of the hole after them. */
+  k = 0;
+  if (gap > 0)
+    {
+      pieces[k].start = 0;
+      pieces[k++].length = gap;
+    }
+  if (!merged)
+    {
+      pieces[k].start = start;
+      pieces[k++].length = n;
+    }
+  if (i < cnt && x[i].length > gap + n)
+    {
+      pieces[k].start = 0;
+      pieces[k++].length = x[i].length - gap - n;
     }
-  disk_inode->length = new_length;
+  if (i < cnt)
+    {
+      memmove (&x[i + k], &x[i + 1], (cnt - i - 1) * sizeof *x);
+      cnt += k - 1;
+    }
+  else
+    cnt += k;
+  memcpy (&x[i], pieces, k * sizeof *x);
+  if (cnt < old_cnt)
+    memset (&x[cnt], 0, (old_cnt - cnt) * sizeof *x);
+
+  if (zero)
+    zero_sectors (start, n);
+  return n;
+}
+
+/* Allocates sectors for up to CNT holes in DISK_INODE, starting
+   with the hole at logical sector IDX, and zeroes them if ZERO.
+   HOME is the sector of DISK_INODE itself, which new data is
+   placed near when nothing else suggests a spot.
+   Returns the number of sectors allocated, which are logical
+   sectors IDX onward; 0 means the disk is full. */
+static size_t
+inode_fill (struct inode_disk *disk_inode, block_sector_t home, size_t idx,
+            size_t cnt, bool zero)
+{
+  if (disk_inode->magic == INODE_EXTENT_MAGIC)
+    return extent_fill (disk_inode, home, idx, cnt, zero);
+  else
+    return block_fill (disk_inode, home, idx, cnt, zero);
+}
 
-  return new_length;
+/* Copies the next bytes of a write, from the buffers at *IOV
+   starting *OFS bytes into the first, into sector SECTOR from
+   byte SECTOR_OFS up to the end of the sector or for SIZE bytes,
+   whichever is less, and advances *IOV and *OFS past them.  If
+   FRESH, SECTOR was just allocated and the rest of it is zeroed
+   instead of read from disk.  Returns the number of bytes
+   copied. */
+static int
+write_chunk (block_sector_t sector, int sector_ofs, off_t size,
+             const struct iovec **iov, size_t *ofs, bool fresh)
+{
+  int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+  int chunk_size = size < sector_left ? size : sector_left;
+
+  /* A sector we overwrite completely need not be read first. */
+  bool whole = sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE;
+  struct cache_entry *e = cache_get (sector, !whole && !fresh);
+  if (fresh && !whole)
+    memset (e->data, 0, BLOCK_SECTOR_SIZE);
+  iov_gather (e->data + sector_ofs, iov, ofs, chunk_size);
+  cache_release (e, true);
+  return chunk_size;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
    less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   Writing past end of file extends it, leaving any gap as a
+   hole.  Sectors are allocated only as they are written. */
 off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+inode_write_at (struct inode *inode, const void *buffer, off_t size,
                 off_t offset)
 {
-  const uint8_t *buffer = buffer_;
-  off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
-  if (inode->deny_write_cnt)
-    return 0;
+  struct iovec iov;
 
-  struct inode_disk disk_inode;
+  iov.iov_base = (void *) buffer;
+  iov.iov_len = size;
+  return inode_writev_at (inode, &iov, 1, offset);
+}
 
-  cache_read(fs_device, inode->sector, &disk_inode);
+/* Writes the CNT buffers in IOV, one after another, into INODE
+   starting at OFFSET, as a single span: the file is extended and
+   its holes filled once for all of them.
+   Returns the number of bytes actually written, which may be
+   less than the buffers' total length if an error occurs. */
+off_t
+inode_writev_at (struct inode *inode, const struct iovec *iov, int cnt,
+                 off_t offset)
+{
+  off_t size = iov_size (iov, cnt);
+  size_t iov_ofs = 0;           /* Offset into *IOV. */
+  off_t bytes_written = 0;
 
-  add_inode(&disk_inode, size + offset);
-  cache_write (fs_device, inode->sector, &disk_inode);
+  if (inode->deny_write_cnt)
+    return 0;
 
   while (size > 0)
     {
-      /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
-      int sector_ofs = offset % BLOCK_SECTOR_SIZE;
-
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
-
-      /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
-        break;
-
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      /* Sector to write, starting byte offset within sector.  A
+         hole gets sectors for up to CACHE_RUN_MAX sectors of the
+         write at once, so they can be contiguous.  Their data goes
+         into the cache before INODE's lock is released, so no one
+         can see what they held before, and each is written to disk
+         once. */
+      size_t idx = offset / BLOCK_SECTOR_SIZE;
+      size_t n = 0;
+      int chunk_size;
+      lock_acquire (&inode->lock);
+      block_sector_t sector_idx = idx_to_sector (inode, idx);
+      if (sector_idx == 0)
         {
-          /* Write full sector directly to disk. */
-          cache_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else
-        {
-          cache_write_bytes (fs_device,sector_idx,buffer+bytes_written,sector_ofs,chunk_size,sector_left);
+          size_t cnt = DIV_ROUND_UP (offset + size, BLOCK_SECTOR_SIZE) - idx;
+          unsigned magic = inode->data.magic;
+          size_t i;
+
+          /* Filling may convert the inode to the block-mapped
+             layout even if it then finds no sectors. */
+          n = inode_fill (&inode->data, inode->sector, idx,
+                          cnt < CACHE_RUN_MAX ? cnt : CACHE_RUN_MAX, false);
+          if (n > 0 || inode->data.magic != magic)
+            {
+              inode->dirty = true;
+              inode_xlate_clear (inode);
+            }
+          for (i = 0; i < n; i++)
+            {
+              chunk_size = write_chunk (idx_to_sector (inode, idx + i),
+                                        offset % BLOCK_SECTOR_SIZE, size,
+                                        &iov, &iov_ofs, true);
+              size -= chunk_size;
+              offset += chunk_size;
+              bytes_written += chunk_size;
+            }
         }
+      lock_release (&inode->lock);
+      if (n > 0)
+        continue;
+      if (sector_idx == 0)
+        break;
+
+      chunk_size = write_chunk (sector_idx, offset % BLOCK_SECTOR_SIZE, size,
+                                &iov, &iov_ofs, false);
+
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  cache_write(fs_device, inode->sector, &disk_inode);
-  free(bounce);
+
+  /* Extend the file over what was written, if it ran past the
+     end.  The new length reaches disk when the inode is next
+     flushed. */
+  lock_acquire (&inode->lock);
+  if (offset > inode->data.length)
+    {
+      inode->data.length = offset;
+      inode->dirty = true;
+    }
+  lock_release (&inode->lock);
   return bytes_written;
 }
 
@@ -887,13 +1720,27 @@ inode_allow_write (struct inode *inode)
   inode->deny_write_cnt--;
 }
 
+/* Lowers INODE's length to LENGTH, if it is longer, undoing a
+   failed extension.  The sectors past the new end stay mapped
+   and are used again if INODE grows back over them. */
+void
+inode_shrink (struct inode *inode, off_t length)
+{
+  lock_acquire (&inode->lock);
+  if (length < inode->data.length)
+    {
+      inode->data.length = length;
+      inode->dirty = true;
+    }
+  lock_release (&inode->lock);
+}
+
 /* Returns the length, in bytes, of INODE's data. */
 off_t
 inode_length (const struct inode *inode)
 {
-  struct inode_disk disk_inode;
-  cache_read(fs_device, inode->sector, &disk_inode);
-  return disk_inode.length;
+  /* A single aligned word, so no need for INODE's lock. */
+  return inode->data.length;
 }
 
 bool 
@@ -6,6 +6,10 @@
 #include "devices/block.h"
 
 struct bitmap;
+struct iovec;
+
+/* Buffer cache size in sectors, set by "-cache=SECTORS". */
+extern size_t cache_size;
 
 void inode_init (void);
 bool inode_create (block_sector_t, off_t);
@@ -16,9 +20,17 @@ void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+off_t inode_readv_at (struct inode *, const struct iovec *, int cnt,
+                      off_t offset);
+off_t inode_writev_at (struct inode *, const struct iovec *, int cnt,
+                       off_t offset);
+void inode_read_ahead (struct inode *, off_t offset, off_t size);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+void inode_shrink (struct inode *, off_t length);
 bool inode_removed(struct inode* inode);
 void cache_write(struct block *block, const block_sector_t sector, void *data);
+void cache_sync (void);
+void cache_tick (int64_t ticks);
 #endif /* filesys/inode.h */
@@ -0,0 +1,25 @@
+#ifndef __LIB_DIRENT_H
+#define __LIB_DIRENT_H
+
+/* Directory entries as returned by the getdents() system call,
+   shared between the kernel and user programs. */
+
+/* Maximum length of a name in a directory entry. */
+#define DIRENT_NAME_MAX 14
+
+/* Type of the file a directory entry names. */
+enum dirent_type
+  {
+    DT_REG = 0,                 /* Ordinary file. */
+    DT_DIR = 1                  /* Directory. */
+  };
+
+/* A directory entry. */
+struct dirent
+  {
+    int d_ino;                          /* Inode number. */
+    int d_type;                         /* An enum dirent_type. */
+    char d_name[DIRENT_NAME_MAX + 1];   /* Null-terminated name. */
+  };
+
+#endif /* lib/dirent.h */
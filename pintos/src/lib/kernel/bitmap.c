@@ -23,11 +23,24 @@ typedef unsigned long elem_type;
 
 /* From the outside, a bitmap is an array of bits.  From the
    inside, it's an array of elem_type (defined above) that
-   simulates an array of bits. */
+   simulates an array of bits.
+
+   Over the bits sit two summary arrays with one bit per element:
+   bit I of ALL_SET is turned on if element I has every one of
+   its bits set, and bit I of ALL_CLEAR if it has none set.
+   bitmap_scan() uses them to skip a whole element, or a whole
+   summary element's worth of elements, that cannot contain the
+   bits it is looking for, instead of testing each bit in turn.
+   The summaries live in the same allocation as the bits and are
+   updated whenever the bits change, but not atomically with
+   them, so a bitmap whose bits are changed from interrupt
+   context must not be scanned at the same time. */
 struct bitmap
   {
     size_t bit_cnt;     /* Number of bits. */
     elem_type *bits;    /* Elements that represent bits. */
+    elem_type *all_set;         /* Elements with all bits set. */
+    elem_type *all_clear;       /* Elements with no bits set. */
   };
 
 /* Returns the index of the element that contains the bit
@@ -60,6 +73,22 @@ byte_cnt (size_t bit_cnt)
   return sizeof (elem_type) * elem_cnt (bit_cnt);
 }
 
+/* Returns the number of bytes required for the elements of one
+   summary array over BIT_CNT bits. */
+static inline size_t
+summary_byte_cnt (size_t bit_cnt)
+{
+  return byte_cnt (elem_cnt (bit_cnt));
+}
+
+/* Returns the number of bytes required for BIT_CNT bits and the
+   summaries over them. */
+static inline size_t
+storage_byte_cnt (size_t bit_cnt)
+{
+  return byte_cnt (bit_cnt) + 2 * summary_byte_cnt (bit_cnt);
+}
+
 /* Returns a bit mask in which the bits actually used in the last
    element of B's bits are set to 1 and the rest are set to 0. */
 static inline elem_type
@@ -69,6 +98,70 @@ last_mask (const struct bitmap *b)
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
 
+/* Returns a bit mask of the bits actually used in element IDX of
+   B's bits. */
+static inline elem_type
+used_mask (const struct bitmap *b, size_t idx)
+{
+  return idx == elem_cnt (b->bit_cnt) - 1 ? last_mask (b) : (elem_type) -1;
+}
+
+/* Returns the summary array of B that marks the elements whose
+   bits are all set to VALUE. */
+static inline elem_type *
+summary (const struct bitmap *b, bool value)
+{
+  return value ? b->all_set : b->all_clear;
+}
+
+/* Points B's bits and summaries into STORAGE, which must hold
+   storage_byte_cnt(B->bit_cnt) bytes, and clears the summaries.
+   The bits themselves are left for the caller to initialize. */
+static void
+init_storage (struct bitmap *b, void *storage)
+{
+  size_t summary_elems = elem_cnt (elem_cnt (b->bit_cnt));
+  size_t i;
+
+  b->bits = storage;
+  b->all_set = b->bits + elem_cnt (b->bit_cnt);
+  b->all_clear = b->all_set + summary_elems;
+  for (i = 0; i < summary_elems; i++)
+    b->all_set[i] = b->all_clear[i] = 0;
+}
+
+/* Brings the summary bits for element IDX of B's bits up to
+   date.  This reads the element and then rewrites the summary
+   elements, so it is not atomic, and not atomic with the change
+   to the element that called for it.  Callers that change a
+   bitmap while another thread may change or scan it must
+   exclude each other, for example by disabling interrupts. */
+static void
+update_summary (struct bitmap *b, size_t idx)
+{
+  elem_type used = used_mask (b, idx);
+  elem_type bits = b->bits[idx] & used;
+  size_t sum_idx = elem_idx (idx);
+  elem_type sum_mask = bit_mask (idx);
+
+  if (bits == used)
+    b->all_set[sum_idx] |= sum_mask;
+  else
+    b->all_set[sum_idx] &= ~sum_mask;
+  if (bits == 0)
+    b->all_clear[sum_idx] |= sum_mask;
+  else
+    b->all_clear[sum_idx] &= ~sum_mask;
+}
+
+/* Returns true if every used bit in element IDX of B's bits is
+   set to VALUE. */
+static inline bool
+elem_all (const struct bitmap *b, size_t idx, bool value)
+{
+  return (summary (b, value)[elem_idx (idx)] & bit_mask (idx)) != 0;
+}
+
 /* Creation and destruction. */
 
 /* Creates and returns a pointer to a newly allocated bitmap with room for
@@ -81,10 +174,11 @@ bitmap_create (size_t bit_cnt)
   struct bitmap *b = malloc (sizeof *b);
   if (b != NULL)
     {
-      b->bit_cnt = bit_cnt;
-      b->bits = malloc (byte_cnt (bit_cnt));
-      if (b->bits != NULL || bit_cnt == 0)
+      void *storage = malloc (storage_byte_cnt (bit_cnt));
+      if (storage != NULL || bit_cnt == 0)
         {
+          b->bit_cnt = bit_cnt;
+          init_storage (b, storage);
           bitmap_set_all (b, false);
           return b;
         }
@@ -104,7 +198,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
   ASSERT (block_size >= bitmap_buf_size (bit_cnt));
 
   b->bit_cnt = bit_cnt;
-  b->bits = (elem_type *) (b + 1);
+  init_storage (b, b + 1);
   bitmap_set_all (b, false);
   return b;
 }
@@ -114,7 +208,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
 size_t
 bitmap_buf_size (size_t bit_cnt)
 {
-  return sizeof (struct bitmap) + byte_cnt (bit_cnt);
+  return sizeof (struct bitmap) + storage_byte_cnt (bit_cnt);
 }
 
 /* Destroys bitmap B, freeing its storage.
@@ -152,7 +246,9 @@ bitmap_set (struct bitmap *b, size_t idx, bool value)
     bitmap_reset (b, idx);
 }
 
-/* Atomically sets the bit numbered BIT_IDX in B to true. */
+/* Atomically sets the bit numbered BIT_IDX in B to true.
+   Only the bit itself changes atomically; see
+   update_summary(). */
 void
 bitmap_mark (struct bitmap *b, size_t bit_idx)
 {
@@ -163,9 +259,12 @@ bitmap_mark (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the OR instruction in [IA32-v2b]. */
   asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  update_summary (b, idx);
 }
 
-/* Atomically sets the bit numbered BIT_IDX in B to false. */
+/* Atomically sets the bit numbered BIT_IDX in B to false.
+   Only the bit itself changes atomically; see
+   update_summary(). */
 void
 bitmap_reset (struct bitmap *b, size_t bit_idx)
 {
@@ -176,11 +275,14 @@ bitmap_reset (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the AND instruction in [IA32-v2a]. */
   asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+  update_summary (b, idx);
 }
 
 /* Atomically toggles the bit numbered IDX in B;
    that is, if it is true, makes it false,
-   and if it is false, makes it true. */
+   and if it is false, makes it true.
+   Only the bit itself changes atomically; see
+   update_summary(). */
 void
 bitmap_flip (struct bitmap *b, size_t bit_idx)
 {
@@ -191,6 +293,7 @@ bitmap_flip (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the XOR instruction in [IA32-v2b]. */
   asm ("xorl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  update_summary (b, idx);
 }
 
 /* Returns the value of the bit numbered IDX in B. */
@@ -213,18 +316,30 @@ bitmap_set_all (struct bitmap *b, bool value)
   bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.
+   Whole elements are set at once, so unlike bitmap_set() this
+   is not atomic. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 {
+  size_t end = start + cnt;
   size_t i;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  i = start;
+  while (i < end)
+    if (i % ELEM_BITS == 0 && end - i >= ELEM_BITS)
+      {
+        size_t idx = elem_idx (i);
+        b->bits[idx] = value ? (elem_type) -1 : 0;
+        update_summary (b, idx);
+        i += ELEM_BITS;
+      }
+    else
+      bitmap_set (b, i++, value);
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -291,20 +406,67 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+
+   The bits are examined in a single pass that tracks the length
+   of the current run of VALUE bits.  Wherever the summaries show
+   that an element holds only VALUE bits, or only !VALUE bits,
+   the whole element is taken in one step, and a summary element
+   showing ELEM_BITS such !VALUE elements in a row skips all of
+   them at once.  Only elements holding both values are tested
+   bit by bit. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
 {
+  size_t run, i;
+
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
-  if (cnt <= b->bit_cnt)
+  if (cnt == 0)
+    return start;
+  if (cnt > b->bit_cnt)
+    return BITMAP_ERROR;
+
+  run = 0;
+  i = start;
+  while (i < b->bit_cnt)
     {
-      size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i;
+      if (i % ELEM_BITS == 0)
+        {
+          size_t idx = elem_idx (i);
+
+          if (idx % ELEM_BITS == 0
+              && summary (b, !value)[elem_idx (idx)] == (elem_type) -1)
+            {
+              run = 0;
+              i += ELEM_BITS * ELEM_BITS;
+              continue;
+            }
+          if (elem_all (b, idx, !value))
+            {
+              run = 0;
+              i += ELEM_BITS;
+              continue;
+            }
+          if (elem_all (b, idx, value) && i + ELEM_BITS <= b->bit_cnt)
+            {
+              run += ELEM_BITS;
+              i += ELEM_BITS;
+              if (run >= cnt)
+                return i - run;
+              continue;
+            }
+        }
+
+      if (bitmap_test (b, i) == value)
+        {
+          if (++run >= cnt)
+            return i + 1 - run;
+        }
+      else
+        run = 0;
+      i++;
     }
   return BITMAP_ERROR;
 }
@@ -314,8 +476,8 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
    and returns the index of the first bit in the group.
    If there is no such group, returns BITMAP_ERROR.
    If CNT is zero, returns 0.
-   Bits are set atomically, but testing bits is not atomic with
-   setting them. */
+   Neither testing nor setting the bits is atomic, so callers
+   must provide their own synchronization. */
 size_t
 bitmap_scan_and_flip (struct bitmap *b, size_t start, size_t cnt, bool value)
 {
@@ -344,8 +506,12 @@ bitmap_read (struct bitmap *b, struct file *file)
   if (b->bit_cnt > 0)
     {
       off_t size = byte_cnt (b->bit_cnt);
+      size_t i;
+
       success = file_read_at (file, b->bits, size, 0) == size;
       b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+      for (i = 0; i < elem_cnt (b->bit_cnt); i++)
+        update_summary (b, i);
     }
   return success;
 }
@@ -358,6 +524,28 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the part of B that holds the CNT bits starting at
+   START to FILE, where bitmap_write() would put it.  Return true
+   if successful, false otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file,
+                    size_t start, size_t cnt)
+{
+  size_t first, last;
+  off_t ofs, size;
+
+  ASSERT (start <= b->bit_cnt);
+  ASSERT (cnt <= b->bit_cnt - start);
+
+  if (cnt == 0)
+    return true;
+  first = elem_idx (start);
+  last = elem_cnt (start + cnt);
+  ofs = first * sizeof (elem_type);
+  size = (last - first) * sizeof (elem_type);
+  return file_write_at (file, b->bits + first, size, ofs) == size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
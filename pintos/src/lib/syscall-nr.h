@@ -31,7 +31,12 @@ enum
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
     SYS_INUMBER,                 /* Returns the inode number for a fd. */
     SYS_BUFFER_READCNT,         /* Returns the buffer read count */
-    SYS_BUFFER_WRITECNT          /* Returns the buffer read count */
+    SYS_BUFFER_WRITECNT,         /* Returns the buffer read count */
+    SYS_GETDENTS,               /* Reads many directory entries. */
+    SYS_READV,                  /* Read from a file into many buffers. */
+    SYS_WRITEV,                 /* Write many buffers to a file. */
+    SYS_PREAD,                  /* Read from a file at a given offset. */
+    SYS_PWRITE                  /* Write to a file at a given offset. */
   };
 
 #endif /* lib/syscall-nr.h */
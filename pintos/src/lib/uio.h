@@ -0,0 +1,19 @@
+#ifndef __LIB_UIO_H
+#define __LIB_UIO_H
+
+#include <stddef.h>
+
+/* Buffer vectors as passed to the readv() and writev() system
+   calls, shared between the kernel and user programs. */
+
+/* Maximum number of buffers in one readv() or writev() call. */
+#define IOV_MAX 32
+
+/* One buffer in a vector. */
+struct iovec
+  {
+    void *iov_base;             /* Start of buffer. */
+    size_t iov_len;             /* Length of buffer in bytes. */
+  };
+
+#endif /* lib/uio.h */
@@ -61,6 +61,25 @@
           retval;                                               \
         })
 
+/* Invokes syscall NUMBER, passing arguments ARG0, ARG1, ARG2,
+   and ARG3, and returns the return value as an `int'. */
+#define syscall4(NUMBER, ARG0, ARG1, ARG2, ARG3)                \
+        ({                                                      \
+          int retval;                                           \
+          asm volatile                                          \
+            ("pushl %[arg3]; pushl %[arg2]; pushl %[arg1]; "    \
+             "pushl %[arg0]; pushl %[number]; int $0x30; "      \
+             "addl $20, %%esp"                                  \
+               : "=a" (retval)                                  \
+               : [number] "i" (NUMBER),                         \
+                 [arg0] "r" (ARG0),                             \
+                 [arg1] "r" (ARG1),                             \
+                 [arg2] "r" (ARG2),                             \
+                 [arg3] "r" (ARG3)                              \
+               : "memory");                                     \
+          retval;                                               \
+        })
+
 int
 practice (int i)
 {
@@ -199,4 +218,34 @@ int
 buffer_writecnt()
 {
   return syscall0 (SYS_BUFFER_WRITECNT);
-}
\ No newline at end of file
+}
+
+int
+getdents (int fd, struct dirent *entries, unsigned cnt)
+{
+  return syscall3 (SYS_GETDENTS, fd, entries, cnt);
+}
+
+int
+readv (int fd, const struct iovec *iov, int cnt)
+{
+  return syscall3 (SYS_READV, fd, iov, cnt);
+}
+
+int
+writev (int fd, const struct iovec *iov, int cnt)
+{
+  return syscall3 (SYS_WRITEV, fd, iov, cnt);
+}
+
+int
+pread (int fd, void *buffer, unsigned size, unsigned offset)
+{
+  return syscall4 (SYS_PREAD, fd, buffer, size, offset);
+}
+
+int
+pwrite (int fd, const void *buffer, unsigned size, unsigned offset)
+{
+  return syscall4 (SYS_PWRITE, fd, buffer, size, offset);
+}
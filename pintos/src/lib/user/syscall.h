@@ -3,6 +3,8 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <dirent.h>
+#include <uio.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -47,5 +49,10 @@ bool isdir (int fd);
 int inumber (int fd);
 int buffer_readcnt (void);
 int buffer_writecnt (void);
+int getdents (int fd, struct dirent *, unsigned cnt);
+int readv (int fd, const struct iovec *, int cnt);
+int writev (int fd, const struct iovec *, int cnt);
+int pread (int fd, void *buffer, unsigned size, unsigned offset);
+int pwrite (int fd, const void *buffer, unsigned size, unsigned offset);
 
 #endif /* lib/user/syscall.h */
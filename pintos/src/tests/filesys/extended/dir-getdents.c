@@ -0,0 +1,92 @@
+/* Lists a directory with getdents(), a few entries per call,
+   and checks that every entry comes back exactly once, with the
+   right inumber and type. */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 20
+
+static bool seen[FILE_CNT + 1];
+
+/* Checks directory entry E from "a" and marks it seen. */
+static void
+check_entry (const struct dirent *e)
+{
+  char name[32];
+  int idx, fd;
+
+  if (!strcmp (e->d_name, "sub"))
+    idx = FILE_CNT;
+  else
+    {
+      idx = atoi (e->d_name + 1);
+      snprintf (name, sizeof name, "f%d", idx);
+      if (idx < 0 || idx >= FILE_CNT || strcmp (e->d_name, name))
+        fail ("unexpected entry \"%s\"", e->d_name);
+    }
+  if (seen[idx])
+    fail ("entry \"%s\" returned twice", e->d_name);
+  seen[idx] = true;
+
+  snprintf (name, sizeof name, "a/%s", e->d_name);
+  fd = open (name);
+  if (fd < 2)
+    fail ("open \"%s\"", name);
+  if (inumber (fd) != e->d_ino)
+    fail ("\"%s\" has inumber %d, not %d", name, inumber (fd), e->d_ino);
+  if (isdir (fd) != (e->d_type == DT_DIR))
+    fail ("\"%s\" has the wrong type", name);
+  close (fd);
+}
+
+void
+test_main (void)
+{
+  struct dirent entries[3];
+  char name[32];
+  int dir_fd, cnt, total, i;
+
+  CHECK (mkdir ("a"), "mkdir \"a\"");
+  CHECK (mkdir ("a/sub"), "mkdir \"a/sub\"");
+  msg ("creating %d files in \"a\"", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "a/f%d", i);
+      if (!create (name, 0))
+        fail ("create \"%s\"", name);
+    }
+
+  CHECK ((dir_fd = open ("a")) > 1, "open \"a\"");
+  msg ("listing \"a\" with getdents");
+  total = 0;
+  while ((cnt = getdents (dir_fd, entries, 3)) > 0)
+    {
+      if (cnt > 3)
+        fail ("getdents returned %d entries for room for 3", cnt);
+      for (i = 0; i < cnt; i++)
+        check_entry (&entries[i]);
+      total += cnt;
+    }
+  if (cnt < 0)
+    fail ("getdents failed");
+  if (total != FILE_CNT + 1)
+    fail ("listed %d entries, expected %d", total, FILE_CNT + 1);
+  msg ("listed every entry once");
+  close (dir_fd);
+
+  msg ("removing files in \"a\"");
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "a/f%d", i);
+      if (!remove (name))
+        fail ("remove \"%s\"", name);
+    }
+  CHECK (remove ("a/sub"), "rmdir \"a/sub\"");
+  CHECK (remove ("a"), "rmdir \"a\"");
+}
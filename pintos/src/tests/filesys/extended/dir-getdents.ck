@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-getdents) begin
+(dir-getdents) mkdir "a"
+(dir-getdents) mkdir "a/sub"
+(dir-getdents) creating 20 files in "a"
+(dir-getdents) open "a"
+(dir-getdents) listing "a" with getdents
+(dir-getdents) listed every entry once
+(dir-getdents) removing files in "a"
+(dir-getdents) rmdir "a/sub"
+(dir-getdents) rmdir "a"
+(dir-getdents) end
+EOF
+pass;
@@ -0,0 +1,62 @@
+/* Writes blocks to a file with pwrite() in scrambled order,
+   leaving a hole, then reads them back with pread() and checks
+   that neither call moves the file position. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BLOCK_SIZE 700
+#define BLOCK_CNT 8
+
+static char buf[BLOCK_SIZE * BLOCK_CNT];
+static char got[BLOCK_SIZE];
+static char zeros[BLOCK_SIZE];
+
+/* Order to write the blocks in.  Block 5 is never written. */
+static const int order[] = {6, 1, 7, 0, 3, 2, 4};
+
+void
+test_main (void)
+{
+  size_t i;
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (create ("index", 0), "create \"index\"");
+  CHECK ((fd = open ("index")) > 1, "open \"index\"");
+
+  msg ("pwrite blocks out of order");
+  for (i = 0; i < sizeof order / sizeof *order; i++)
+    {
+      int ofs = order[i] * BLOCK_SIZE;
+      if (pwrite (fd, buf + ofs, BLOCK_SIZE, ofs) != BLOCK_SIZE)
+        fail ("pwrite of block %d failed", order[i]);
+    }
+  if (tell (fd) != 0)
+    fail ("pwrite moved the position to %u", tell (fd));
+  if (filesize (fd) != BLOCK_SIZE * BLOCK_CNT)
+    fail ("file size is %d, not %d", filesize (fd), BLOCK_SIZE * BLOCK_CNT);
+
+  msg ("pread blocks back");
+  for (i = BLOCK_CNT; i-- > 0; )
+    {
+      int ofs = i * BLOCK_SIZE;
+      if (pread (fd, got, BLOCK_SIZE, ofs) != BLOCK_SIZE)
+        fail ("pread of block %zu failed", i);
+      if (memcmp (got, i == 5 ? zeros : buf + ofs, BLOCK_SIZE))
+        fail ("block %zu differs from what was written", i);
+    }
+  if (tell (fd) != 0)
+    fail ("pread moved the position to %u", tell (fd));
+  if (pread (fd, got, BLOCK_SIZE, BLOCK_SIZE * BLOCK_CNT) != 0)
+    fail ("pread at end of file read data");
+  msg ("data matches");
+  close (fd);
+
+  CHECK (remove ("index"), "remove \"index\"");
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(file-pread) begin
+(file-pread) create "index"
+(file-pread) open "index"
+(file-pread) pwrite blocks out of order
+(file-pread) pread blocks back
+(file-pread) data matches
+(file-pread) remove "index"
+(file-pread) end
+EOF
+pass;
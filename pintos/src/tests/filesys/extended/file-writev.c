@@ -0,0 +1,71 @@
+/* Writes records to a file with writev(), several per call and
+   straddling sector boundaries, then reads them back with
+   readv() split at different points and checks the data. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define RECORD_CNT 6
+#define FILE_SIZE (100 + 300 + 612 + 1 + 1000 + 37)
+
+static char buf[FILE_SIZE];
+static char got[FILE_SIZE];
+
+static const size_t record_len[RECORD_CNT] = {100, 300, 612, 1, 1000, 37};
+
+void
+test_main (void)
+{
+  struct iovec iov[RECORD_CNT];
+  size_t ofs;
+  int fd, i;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (create ("records", 0), "create \"records\"");
+  CHECK ((fd = open ("records")) > 1, "open \"records\"");
+
+  /* Write the records, three per call. */
+  for (i = 0, ofs = 0; i < RECORD_CNT; ofs += record_len[i++])
+    {
+      iov[i].iov_base = buf + ofs;
+      iov[i].iov_len = record_len[i];
+    }
+  msg ("writev records");
+  if (writev (fd, iov, 3) != 100 + 300 + 612)
+    fail ("first writev wrote the wrong amount");
+  if (writev (fd, iov + 3, 3) != 1 + 1000 + 37)
+    fail ("second writev wrote the wrong amount");
+  if (tell (fd) != FILE_SIZE)
+    fail ("position is %u after writev, not %d", tell (fd), FILE_SIZE);
+  if (filesize (fd) != FILE_SIZE)
+    fail ("file size is %d, not %d", filesize (fd), FILE_SIZE);
+
+  /* Read it all back in two calls, split differently. */
+  msg ("readv records");
+  seek (fd, 0);
+  iov[0].iov_base = got;
+  iov[0].iov_len = 700;
+  iov[1].iov_base = got + 700;
+  iov[1].iov_len = 0;
+  iov[2].iov_base = got + 700;
+  iov[2].iov_len = 1000;
+  if (readv (fd, iov, 3) != 1700)
+    fail ("first readv read the wrong amount");
+  iov[0].iov_base = got + 1700;
+  iov[0].iov_len = FILE_SIZE - 1700;
+  iov[1].iov_base = got + FILE_SIZE - 1700;
+  iov[1].iov_len = 100;
+  if (readv (fd, iov, 2) != FILE_SIZE - 1700)
+    fail ("second readv did not stop at end of file");
+  if (memcmp (buf, got, FILE_SIZE))
+    fail ("data read back differs from data written");
+  msg ("data matches");
+  close (fd);
+
+  CHECK (remove ("records"), "remove \"records\"");
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(file-writev) begin
+(file-writev) create "records"
+(file-writev) open "records"
+(file-writev) writev records
+(file-writev) readv records
+(file-writev) data matches
+(file-writev) remove "records"
+(file-writev) end
+EOF
+pass;
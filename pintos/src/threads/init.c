@@ -36,6 +36,7 @@
 #include "devices/ide.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/inode.h"
 #endif
 
 /* Page directory with kernel mappings only. */
@@ -247,6 +248,10 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-cache"))
+        cache_size = atoi (value);
+      else if (!strcmp (name, "-dma"))
+        ide_dma = true;
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -373,6 +378,8 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -cache=SECTORS     Cache up to SECTORS file system sectors.\n"
+          "  -dma               Use bus-master DMA for IDE disks if possible.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
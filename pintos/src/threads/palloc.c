@@ -7,6 +7,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -73,12 +74,18 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
   void *pages;
   size_t page_idx;
+  enum intr_level old_level;
 
   if (page_cnt == 0)
     return NULL;
 
+  /* Interrupts stay off while the used map changes, because
+     palloc_free_multiple() may run in the middle of a thread
+     switch, where it cannot take the lock. */
   lock_acquire (&pool->lock);
+  old_level = intr_disable ();
   page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+  intr_set_level (old_level);
   lock_release (&pool->lock);
 
   if (page_idx != BITMAP_ERROR)
@@ -119,6 +126,7 @@ palloc_free_multiple (void *pages, size_t page_cnt)
 {
   struct pool *pool;
   size_t page_idx;
+  enum intr_level old_level;
 
   ASSERT (pg_ofs (pages) == 0);
   if (pages == NULL || page_cnt == 0)
@@ -137,8 +145,14 @@ palloc_free_multiple (void *pages, size_t page_cnt)
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
+  /* The used map's summary bits are not updated atomically, so
+     the update must not interleave with palloc_get_multiple()'s.
+     thread_schedule_tail() frees the dying thread's page with
+     interrupts off, so this cannot sleep on the pool's lock. */
+  old_level = intr_disable ();
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  intr_set_level (old_level);
 }
 
 /* Frees the page at PAGE. */
@@ -188,9 +188,8 @@ thread_create (const char *name, int priority,
   /* Initialize thread. */
   init_thread (t, name, priority);
   tid = t->tid = allocate_tid ();
-  list_init (&t->open_list);
-
-  t->fd_count = 3;
+  t->fds = NULL;
+  t->fd_cnt = 0;
   t->work_dir = NULL;
 
   /* Stack frame for kernel_thread(). */
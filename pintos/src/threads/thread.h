@@ -100,8 +100,8 @@ struct thread
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
-    int fd_count;
-    struct list open_list;
+    struct file_info **fds;             /* Open files, indexed by fd. */
+    int fd_cnt;                         /* Number of slots in FDS. */
     struct file* exec_file;
     
     struct dir* work_dir; /* working directory for the process*/
@@ -2,8 +2,10 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include "userprog/gdt.h"
+#include "userprog/syscall.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -149,6 +151,21 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
+  /* A fault in get_user() or put_user() in userprog/syscall.c
+     means a system call passed a bad pointer.  They put the
+     address to resume at in EAX and expect -1 there if the access
+     faults.  Other kernel code, such as file_read() or putbuf()
+     on a buffer the system call checked beforehand, also touches
+     user memory directly; a fault there, like any other kernel
+     fault, is a kernel bug and falls through to kill the
+     kernel. */
+  if (!user && is_user_vaddr (fault_addr) && syscall_user_access (f->eip))
+    {
+      f->eip = (void (*) (void)) f->eax;
+      f->eax = -1;
+      return;
+    }
+
   /* To implement virtual memory, delete the rest of the function
      body, and replace it with code that brings in the page to
      which fault_addr refers. */
@@ -8,7 +8,6 @@ tid_t process_execute (const char *file_name);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (void);
-int find_fd(void);
 
 /*keep the status of the two processes*/
 struct wait_status {
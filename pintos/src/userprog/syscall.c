@@ -3,9 +3,13 @@
 #include <syscall-nr.h>
 #include <debug.h>
 #include <stddef.h>
+#include <inttypes.h>
 #include <random.h>
 #include <string.h>
+#include <uio.h>
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "userprog/process.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
@@ -13,19 +17,93 @@
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "devices/block.h"
+#include "devices/input.h"
+#include "devices/shutdown.h"
+#include "filesys/file.h"
 
 static void syscall_handler (struct intr_frame *f);
 struct file_info* files_helper (int fd);
 struct file_info* create_files_struct(struct file *open_file);
 int write (int fd, const void *buffer, unsigned length);
-int read (int fd, const void *buffer, unsigned length);
-int seek (int fd, unsigned length);
+int read (int fd, void *buffer, unsigned length);
 tid_t handle_exec(const char *cmd_line);
 static int get_user (const uint8_t *uaddr);
 static bool put_user (uint8_t *udst, uint8_t byte);
+static bool copy_from_user (void *dst, const void *usrc, size_t size);
+static bool copy_to_user (void *udst, const void *src, size_t size);
+static int strncpy_from_user (char *dst, const char *usrc, size_t size);
+static bool check_user_buffer (const void *ubuf, size_t size, bool writable);
+static char *copy_in_string (const char *ustr);
+static void bad_user_access (void) NO_RETURN;
 
 static void clear_all_file();
 
+typedef int syscall_func (const uint32_t *args);
+
+static syscall_func sys_halt, sys_exit, sys_exec, sys_wait, sys_create,
+  sys_remove, sys_open, sys_filesize, sys_read, sys_write, sys_seek,
+  sys_tell, sys_close, sys_practice, sys_chdir, sys_mkdir, sys_readdir,
+  sys_isdir, sys_inumber, sys_buffer_readcnt, sys_buffer_writecnt,
+  sys_getdents, sys_readv, sys_writev, sys_pread, sys_pwrite;
+
+/* A system call. */
+struct syscall
+  {
+    syscall_func *func;                 /* Handler, null if unsupported. */
+    int arg_cnt;                        /* Number of arguments. */
+    const char *name;                   /* Name, for statistics. */
+  };
+
+/* System calls, indexed by number. */
+static const struct syscall syscalls[] =
+  {
+    [SYS_HALT] = {sys_halt, 0, "halt"},
+    [SYS_EXIT] = {sys_exit, 1, "exit"},
+    [SYS_EXEC] = {sys_exec, 1, "exec"},
+    [SYS_WAIT] = {sys_wait, 1, "wait"},
+    [SYS_CREATE] = {sys_create, 2, "create"},
+    [SYS_REMOVE] = {sys_remove, 1, "remove"},
+    [SYS_OPEN] = {sys_open, 1, "open"},
+    [SYS_FILESIZE] = {sys_filesize, 1, "filesize"},
+    [SYS_READ] = {sys_read, 3, "read"},
+    [SYS_WRITE] = {sys_write, 3, "write"},
+    [SYS_SEEK] = {sys_seek, 2, "seek"},
+    [SYS_TELL] = {sys_tell, 1, "tell"},
+    [SYS_CLOSE] = {sys_close, 1, "close"},
+    [SYS_PRACTICE] = {sys_practice, 1, "practice"},
+    [SYS_MMAP] = {NULL, 2, "mmap"},
+    [SYS_MUNMAP] = {NULL, 1, "munmap"},
+    [SYS_CHDIR] = {sys_chdir, 1, "chdir"},
+    [SYS_MKDIR] = {sys_mkdir, 1, "mkdir"},
+    [SYS_READDIR] = {sys_readdir, 2, "readdir"},
+    [SYS_ISDIR] = {sys_isdir, 1, "isdir"},
+    [SYS_INUMBER] = {sys_inumber, 1, "inumber"},
+    [SYS_BUFFER_READCNT] = {sys_buffer_readcnt, 0, "buffer_readcnt"},
+    [SYS_BUFFER_WRITECNT] = {sys_buffer_writecnt, 0, "buffer_writecnt"},
+    [SYS_GETDENTS] = {sys_getdents, 3, "getdents"},
+    [SYS_READV] = {sys_readv, 3, "readv"},
+    [SYS_WRITEV] = {sys_writev, 3, "writev"},
+    [SYS_PREAD] = {sys_pread, 4, "pread"},
+    [SYS_PWRITE] = {sys_pwrite, 4, "pwrite"},
+  };
+
+/* Number of entries in syscalls[]. */
+#define SYSCALL_CNT (sizeof syscalls / sizeof *syscalls)
+
+/* Per-call statistics: how many times each call was made, and
+   the CPU cycles spent in the calls that returned. */
+static unsigned syscall_calls[SYSCALL_CNT];
+static uint64_t syscall_cycles[SYSCALL_CNT];
+
+/* Returns the CPU's time-stamp counter. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
 void
 syscall_init (void)
 {
@@ -33,362 +111,525 @@ syscall_init (void)
  
 }
 
+/* Prints system call statistics. */
+void
+syscall_print_stats (void)
+{
+  size_t i;
+
+  for (i = 0; i < SYSCALL_CNT; i++)
+    if (syscall_calls[i] > 0)
+      printf ("Syscall: %s: %u calls, %"PRIu64" cycles each\n",
+              syscalls[i].name, syscall_calls[i],
+              syscall_cycles[i] / syscall_calls[i]);
+}
+
 static void
 syscall_handler (struct intr_frame *f)
 {
-  struct list open_list = thread_current()->open_list;
-  uint32_t* args = ((uint32_t*) f->esp);
-  uint32_t* pagedir = thread_current()->pagedir;
-  /*sanity check 1, the syscall attribute should not exceeding memory space*/
-  if((int*)f->esp <= 0x08048000 ||(args+1 >= PHYS_BASE))
+  const struct syscall *sc;
+  uint32_t args[5];
+  uint64_t start;
+
+  /* Copy in the system call number, then as many arguments as
+     it takes.  A bad stack pointer faults in copy_from_user(). */
+  if (!copy_from_user (args, f->esp, sizeof *args))
+    bad_user_access ();
+  if (args[0] >= SYSCALL_CNT || syscalls[args[0]].func == NULL)
     {
-      handle_exit(-1);
-      thread_exit();
+      f->eax = -1;
+      return;
     }
-  /* sanity check 2, the syscall attributes should not reach out of the process`s pages*/
-  if (pagedir_get_page ( pagedir, args) == NULL)
-    {
-      handle_exit(-1);
-      thread_exit();
-    } 
-  /*shared by subdirectory syscalls*/  
-  char tail_name[NAME_MAX+1] ;
-  struct thread *t = thread_current ();
-  struct dir *next_dir = (struct dir*) malloc (sizeof (struct dir));
+  sc = &syscalls[args[0]];
+  if (!copy_from_user (args + 1, (uint32_t *) f->esp + 1,
+                       sc->arg_cnt * sizeof *args))
+    bad_user_access ();
 
-  switch (args[0]) 
-  {
-    case SYS_EXIT:
-      {
-         f->eax = args[1];
-         handle_exit(args[1]);
-         thread_exit();
-         break;
-      }
-    case SYS_EXEC: 
-      { 
-        if(pagedir_get_page (pagedir, args[1]) == NULL)
-         {
-           handle_exit(-1);
-           thread_exit();
-         }
-         f->eax = handle_exec (args[1]); 
-         break;
-      } 
-    case SYS_WAIT:
-      {
-        f->eax = process_wait(args[1]);
-        break;
-      } 
-    case SYS_PRACTICE:
-      {
-        f->eax =  args[1] + 1;
-        break;
-      }
-    case SYS_HALT: 
-      {
-        shutdown_power_off();
-      }
-    case SYS_READ:
-      {
-        if( args[1] == 0) 
-          {
-            uint8_t *buffer = (uint8_t*) args[2];
-            int i = 0;
-            while (i < args[3]) 
-              {
-                 buffer[i] = input_getc ();
-                if (buffer[i++] == '\n')
-                  break;
-              }
-            f->eax = i;
-          }
-        else
-          f->eax = read (args[1], (void *) args[2], args[3]);
-         break;
-     } 
-
-    case SYS_CREATE: 
-     {
-       if (args[1] == 0) 
-         {
-           f->eax = -1;
-           handle_exit(-1);
-           thread_exit();
-         } 
-       else 
-         {
-           void* valid_adress = pagedir_get_page(pagedir, args[1]);
-           if (valid_adress == NULL) 
-             {
-               f->eax = -1;
-               handle_exit(-1);
-               thread_exit();
-             }
+  syscall_calls[args[0]]++;
+  start = rdtsc ();
+  f->eax = sc->func (args);
+  syscall_cycles[args[0]] += rdtsc () - start;
+}
 
-           if (args[1] == NULL || !strcmp(args[1], "")) 
-             {
-               f->eax = 0;
-               break;
-             } 
-           if( t -> work_dir == NULL)
-             t -> work_dir = dir_open_root ();
-           if(find_path( t-> work_dir, args[1], tail_name, next_dir))
-             { 
-               /* currently move to given directory, then move back*/
-               struct dir *temp = t -> work_dir;
-               t -> work_dir = next_dir;
-  	       f -> eax = filesys_create(tail_name, args[2],IS_REG);
-               t -> work_dir = temp;
-             }
-           else
-             f -> eax = 0;
+/* Closes the directory that find_path() stored in DIR, which
+   lives on the caller's stack rather than the heap. */
+static void
+close_found_dir (struct dir *dir)
+{
+  inode_close (dir_get_inode (dir));
+}
+
+static int
+sys_halt (const uint32_t *args UNUSED)
+{
+  shutdown_power_off();
+}
+
+static int
+sys_exit (const uint32_t *args)
+{
+  handle_exit(args[1]);
+  thread_exit();
+}
+
+static int
+sys_exec (const uint32_t *args)
+{
+  char *path = copy_in_string ((const char *) args[1]);
+  tid_t tid = path != NULL ? handle_exec (path) : -1;
+  palloc_free_page (path);
+  return tid;
+}
+
+static int
+sys_wait (const uint32_t *args)
+{
+  return process_wait(args[1]);
+}
+
+static int
+sys_practice (const uint32_t *args)
+{
+  return args[1] + 1;
+}
+
+static int
+sys_read (const uint32_t *args)
+{
+  if( args[1] == 0) 
+    {
+      uint8_t *buffer = (uint8_t*) args[2];
+      unsigned i = 0;
+      while (i < args[3]) 
+        {
+          uint8_t c = input_getc ();
+          if (!put_user (buffer + i++, c))
+            bad_user_access ();
+          if (c == '\n')
+            break;
         }
-        break;
+      return i;
+    }
+  return read (args[1], (void *) args[2], args[3]);
+}
 
-     }
-   case SYS_REMOVE: 
+static int
+sys_write (const uint32_t *args)
+{
+  return write (args[1], (void *) args[2], args[3]);
+}
+
+static int
+sys_create (const uint32_t *args)
+{
+  struct thread *t = thread_current ();
+  char *path = copy_in_string ((const char *) args[1]);
+  char tail_name[NAME_MAX+1];
+  struct dir next_dir;
+  bool success = false;
+
+  if (path == NULL)
+    return false;
+  if (path[0] != '\0')
     {
-      
-      find_path (t-> work_dir, args[1], tail_name, next_dir);
+      if( t -> work_dir == NULL)
+        t -> work_dir = dir_open_root ();
+      if(find_path( t-> work_dir, path, tail_name, &next_dir))
+        { 
+          /* currently move to given directory, then move back*/
+          struct dir *temp = t -> work_dir;
+          t -> work_dir = &next_dir;
+          success = filesys_create(tail_name, args[2],IS_REG);
+          t -> work_dir = temp;
+        }
+    }
+  palloc_free_page (path);
+  return success;
+}
+
+static int
+sys_remove (const uint32_t *args)
+{
+  struct thread *t = thread_current ();
+  char *path = copy_in_string ((const char *) args[1]);
+  char tail_name[NAME_MAX+1];
+  struct dir next_dir;
+  bool success = false;
 
+  if (path == NULL)
+    return false;
+  if (find_path (t-> work_dir, path, tail_name, &next_dir))
+    {
       struct dir *temp = t -> work_dir;
-      t -> work_dir = next_dir;
-      f->eax = filesys_remove(tail_name);
+      t -> work_dir = &next_dir;
+      success = filesys_remove(tail_name);
       t -> work_dir = temp;
-      break;
-    } 
+    }
+  palloc_free_page (path);
+  return success;
+}
 
-  case SYS_OPEN: 
-   {
-     if(!is_user_vaddr(args[1]))
-     { 
-        handle_exit(-1);
-        thread_exit();
-     }
-     void* valid_adress = pagedir_get_page(pagedir, args[1]);
-     if (valid_adress == NULL ) 
-       {
-         f->eax = -1;
-         handle_exit(-1);
-         thread_exit();
-       } 
-     else if (args[1] == NULL || !strcmp(args[1], "")) 
-       {
-         f->eax = -1;
-       } 
-     else 
-       {
-         struct dir_entry* dirent = dir_getdirent (dir_open_current (), args[1]);
-         if(dirent == NULL)
-           {
-             f -> eax = -1;
-             break;
-           }
-
-         struct file *open_file = file_open (inode_open (dirent -> inode_sector));
-    	  if (open_file != NULL)
+static int
+sys_open (const uint32_t *args)
+{
+  char *path = copy_in_string ((const char *) args[1]);
+  int fd = -1;
+
+  if (path == NULL)
+    return -1;
+  if (path[0] != '\0') 
+    {
+      struct dir_entry* dirent = dir_getdirent (dir_open_current (), path);
+      if(dirent != NULL)
+        {
+          struct file *open_file = file_open (inode_open (dirent -> inode_sector));
+          struct file_info *fi = NULL;
+          if (open_file != NULL
+              && (fi = create_files_struct (open_file)) != NULL)
             {
-    	      struct file_info *fi = create_files_struct (open_file);
               fi -> dirent = dirent;
-  	      list_push_back (&thread_current()->open_list, &fi->elem);
-  	      f->eax = fi->file_descriptor;
+              fd = fi->file_descriptor;
               if(dirent -> type == IS_DIR)
                 {
                   file_close(fi -> file);
                   fi -> file  = NULL;
                 }
-  	    } 
+            } 
           else 
             {
-              f->eax = -1;
+              file_close (open_file);
+              free (dirent);
             }
-      
         }
-      break;
     }
+  palloc_free_page (path);
+  return fd;
+}
 
-  case SYS_WRITE:
-    {
-       f->eax = write (args[1], (void *) args[2], args[3]);
-       break;
-    }
-  case SYS_CHDIR:
+static int
+sys_chdir (const uint32_t *args)
+{
+  struct thread *t = thread_current ();
+  char *path = copy_in_string ((const char *) args[1]);
+  char tail_name[NAME_MAX+1];
+  struct dir next_dir;
+  bool success = false;
+
+  if (path == NULL)
+    return false;
+  if (path[0] != '\0') 
     {
-      if (args[1] == NULL || !strcmp(args[1], "")) 
-        {
-          f->eax = false;
-          break;
-        } 
       if (t -> work_dir == NULL)
         t -> work_dir = dir_open_root ();
-      if (find_path (t -> work_dir ,args[1], tail_name, next_dir))
+      if (find_path (t -> work_dir ,path, tail_name, &next_dir))
         {
           struct inode *in;
-          if(t -> work_dir -> inode != next_dir -> inode)
+          if(t -> work_dir -> inode != next_dir.inode)
             dir_close (t -> work_dir);
-          dir_lookup (next_dir, tail_name, &in);
-          dir_close (next_dir);
+          dir_lookup (&next_dir, tail_name, &in);
+          close_found_dir (&next_dir);
           if (in != NULL)
             {
               t -> work_dir = dir_open (in);
-              f -> eax = true;
-              break;
+              success = true;
             }
         }
-      /* file not found or error path*/
-      f -> eax = false;
-      break;      
     }
-  case SYS_MKDIR:
+  palloc_free_page (path);
+  return success;
+}
+
+static int
+sys_mkdir (const uint32_t *args)
+{
+  struct thread *t = thread_current ();
+  char *path = copy_in_string ((const char *) args[1]);
+  char tail_name[NAME_MAX+1];
+  struct dir next_dir;
+  bool success = false;
+
+  if (path == NULL)
+    return false;
+  if (path[0] != '\0'
+      && find_path(dir_open_current(), path, tail_name, &next_dir))
     {
-      if (args[1] == NULL || !strcmp(args[1], "")) 
+      struct inode *in;
+      /* there is given directory in the path*/
+      if (dir_lookup(&next_dir, tail_name, &in))
         {
-          f->eax = false;
-          break;
+          inode_close (in);
+          close_found_dir (&next_dir);
         }
-       if(find_path(dir_open_current(), args[1], tail_name, next_dir))
-         {
-           struct inode *in;
-           /* there is given directory in the path*/
-           if (dir_lookup(next_dir, tail_name, &in))
-             {
-               f->eax = false;
-               dir_close(next_dir);
-               break;
-             }
-           else
-             {
-               /* since filesys_create will always lookup working directory
-                  we need to change current working directroy into next_dir*/
-               struct dir* temp = t-> work_dir;
-               t -> work_dir = next_dir;
-               bool success = filesys_create(tail_name, 512, IS_DIR);
-               f -> eax = success;
-               if (!success)
-               {
-                 t -> work_dir = temp;
-                 dir_close(next_dir);
-                 break;
-               }
-               /* dive into the newly create directory, then add . and .. into it*/
-               struct inode* new_dir_inode;
-               dir_lookup(next_dir, tail_name, &new_dir_inode);
-               struct dir* new_dir = dir_open (new_dir_inode);
-               if(!dir_add (new_dir, "..", inode_get_inumber(next_dir -> inode), IS_DIR)
-                ||!dir_add (new_dir, ".", inode_get_inumber(new_dir -> inode), IS_DIR))
+      else
+        {
+          /* since filesys_create will always lookup working directory
+             we need to change current working directroy into next_dir*/
+          struct dir* temp = t-> work_dir;
+          t -> work_dir = &next_dir;
+          success = filesys_create(tail_name, 512, IS_DIR);
+          if (success)
+            {
+              /* dive into the newly create directory, then add . and .. into it*/
+              struct inode* new_dir_inode;
+              dir_lookup(&next_dir, tail_name, &new_dir_inode);
+              struct dir* new_dir = dir_open (new_dir_inode);
+              if(!dir_add (new_dir, "..", inode_get_inumber(next_dir.inode), IS_DIR)
+                 ||!dir_add (new_dir, ".", inode_get_inumber(new_dir -> inode), IS_DIR))
                 {
-                  
                   dir_close(new_dir);
-                  dir_remove(next_dir, tail_name);
-                  f -> eax = false;
+                  dir_remove(&next_dir, tail_name);
+                  success = false;
                 }
+            }
+          t -> work_dir = temp;
+          close_found_dir (&next_dir);
+        }
+    }
+  palloc_free_page (path);
+  return success;
+}
 
-               t -> work_dir = temp;
-               dir_close(next_dir);
-             }
-         }
-       else
-         f -> eax = false;
-       break;
+static int
+sys_readdir (const uint32_t *args)
+{
+  struct file_info *dir_fd = files_helper (args[1]);
+  char name[NAME_MAX + 1];
+  bool success;
+
+  if (dir_fd == NULL || dir_fd -> dirent -> type != IS_DIR)
+    return false;
+  if(dir_fd -> file == NULL)
+    dir_fd -> file = (struct file *) dir_open (inode_open(dir_fd -> dirent -> inode_sector));
+  success = dir_readdir((struct dir *) dir_fd -> file, name);
+  if (success && !copy_to_user ((char *) args[2], name, strlen (name) + 1))
+    bad_user_access ();
+  return success;
+}
+
+static int
+sys_getdents (const uint32_t *args)
+{
+  struct file_info *dir_fd = files_helper (args[1]);
+  struct dirent *entries = (struct dirent *) args[2];
+  unsigned cnt = args[3];
+
+  if (cnt > (size_t) -1 / sizeof *entries
+      || !check_user_buffer (entries, cnt * sizeof *entries, true))
+    bad_user_access ();
+
+  if (dir_fd == NULL || dir_fd -> dirent -> type != IS_DIR)
+    return -1;
+  if (dir_fd -> file == NULL)
+    dir_fd -> file = (struct file *) dir_open (inode_open (dir_fd -> dirent -> inode_sector));
+  return dir_getdents ((struct dir *) dir_fd -> file, entries, cnt);
+}
+
+/* Copies the CNT-buffer vector at user address UIOV into IOV,
+   which has room for IOV_MAX buffers, and checks that each
+   buffer is user memory, writable if WRITABLE is true.
+   Returns false if CNT is out of range or the buffers are too
+   long in total.  Kills the process on a bad address. */
+static bool
+copy_in_iovec (struct iovec *iov, const struct iovec *uiov, int cnt,
+               bool writable)
+{
+  size_t size = 0;
+  int i;
+
+  if (cnt < 0 || cnt > IOV_MAX)
+    return false;
+  if (!copy_from_user (iov, uiov, cnt * sizeof *iov))
+    bad_user_access ();
+  for (i = 0; i < cnt; i++)
+    {
+      if (iov[i].iov_len > INT32_MAX - size)
+        return false;
+      size += iov[i].iov_len;
+      if (!check_user_buffer (iov[i].iov_base, iov[i].iov_len, writable))
+        bad_user_access ();
     }
-   case SYS_READDIR:
-     {
-       struct file_info *dir_fd = files_helper (args[1]);
-       if(dir_fd -> file == NULL)
-          dir_fd -> file = dir_open (inode_open(dir_fd -> dirent -> inode_sector));
-       f -> eax = dir_readdir(dir_fd -> file, args[2]);
-       break;
-     }
-   case SYS_ISDIR:
-     {
-       struct file_info *dir_fd = files_helper (args[1]);
-       f -> eax = dir_fd -> dirent -> type == IS_DIR ? true : false;
-       break;
-     }
-   case SYS_INUMBER:
-     {
-       struct file_info *dir_fd = files_helper (args[1]);
-       f -> eax = dir_fd -> dirent -> inode_sector;
-       break;
-     }
-   case SYS_BUFFER_READCNT:
-     {
-       f -> eax = block_print_read_cnt (fs_device);
-       break;
-     }
-   case SYS_BUFFER_WRITECNT:
-     {
-       f -> eax = block_print_write_cnt (fs_device);
-       break;
-     }
-   default:
+  return true;
+}
+
+static int
+sys_readv (const uint32_t *args)
+{
+  struct iovec iov[IOV_MAX];
+  int cnt = args[3];
+  struct file_info *curr_file;
+
+  if (!copy_in_iovec (iov, (const struct iovec *) args[2], cnt, true))
+    return -1;
+  if (args[1] == 0)
     {
-      // TODO: Find the current file
-      struct file_info *curr_file = files_helper (args[1]);
-      if (curr_file == NULL)
-        f->eax = -1;
-  
-      else if (args[0] == SYS_FILESIZE)
-        f->eax = file_length (curr_file->file);
-    
-  
-      else if (args[0] == SYS_SEEK)
-        file_seek (curr_file->file, args[2]);
-        
-  
-      else if (args[0] == SYS_TELL)
+      /* Console input ends at the first new-line, as in read(). */
+      int bytes_read = 0;
+      int i;
+      for (i = 0; i < cnt; i++)
         {
-          int test = file_tell (curr_file->file);
-          f->eax = test;
-
-        }
-       
-  
-      else if (args[0] == SYS_CLOSE) 
-             {
-               if (args[1] == 1 || args[1] == 2) 
-                 {
-                   f->eax = -1;
-                 }
-               else 
-                {
-                  if (curr_file->file_descriptor == thread_current()->fd_count) 
-                    {
-                      thread_current()->fd_count = thread_current()->fd_count - 1;
-                    }
-                  list_remove(&curr_file->elem);
-                  if(curr_file -> dirent -> type == IS_REG)
-    	            file_close (curr_file->file);
-                  else
-                    dir_close (curr_file ->file);
-                  free(curr_file -> dirent);
-    	          free(curr_file);
-                 }
+          uint8_t *buffer = iov[i].iov_base;
+          size_t j;
+          for (j = 0; j < iov[i].iov_len; j++)
+            {
+              buffer[j] = input_getc ();
+              bytes_read++;
+              if (buffer[j] == '\n')
+                return bytes_read;
             }
+        }
+      return bytes_read;
     }
-  }
+  curr_file = files_helper (args[1]);
+  if (curr_file == NULL || curr_file -> dirent -> type == IS_DIR)
+    return -1;
+  return file_readv (curr_file -> file, iov, cnt);
 }
 
-
-int read (int fd, const void *buffer, unsigned length)
+static int
+sys_writev (const uint32_t *args)
 {
-  if (fd == 0) /* if fd == STDIN_FILENO */
-  {
-    int i = 0;
-    for (i; i < length; i++)
+  struct iovec iov[IOV_MAX];
+  int cnt = args[3];
+  struct file_info *curr_file;
+
+  if (!copy_in_iovec (iov, (const struct iovec *) args[2], cnt, false))
+    return -1;
+  if (args[1] == 1)
     {
-      char *temp;
-      temp = (char*) (buffer + i); /* Write the next char */
-      *temp = input_getc();
-      return 0;
+      int bytes_written = 0;
+      int i;
+      for (i = 0; i < cnt; i++)
+        {
+          putbuf (iov[i].iov_base, iov[i].iov_len);
+          bytes_written += iov[i].iov_len;
+        }
+      return bytes_written;
     }
-  }
-  if (!is_user_vaddr(buffer) || buffer == NULL) 
-    {
-      handle_exit(-1);
-      thread_exit();
-    } 
+  curr_file = files_helper (args[1]);
+  if (curr_file == NULL || curr_file -> dirent -> type == IS_DIR)
+    return -1;
+  return file_writev (curr_file -> file, iov, cnt);
+}
+
+/* Returns the regular file open as FD, for pread() or pwrite()
+   of SIZE bytes at OFFSET, or a null pointer if FD is not a
+   regular file or the bytes would run past the largest offset. */
+static struct file *
+positional_file (int fd, unsigned size, unsigned offset)
+{
+  struct file_info *curr_file = files_helper (fd);
+
+  if (curr_file == NULL || curr_file -> dirent -> type == IS_DIR
+      || size > INT32_MAX || offset > INT32_MAX - size)
+    return NULL;
+  return curr_file -> file;
+}
+
+static int
+sys_pread (const uint32_t *args)
+{
+  struct file *file;
+
+  if (!check_user_buffer ((void *) args[2], args[3], true))
+    bad_user_access ();
+  file = positional_file (args[1], args[3], args[4]);
+  if (file == NULL)
+    return -1;
+  return file_read_at (file, (void *) args[2], args[3], args[4]);
+}
+
+static int
+sys_pwrite (const uint32_t *args)
+{
+  struct file *file;
+
+  if (!check_user_buffer ((void *) args[2], args[3], false))
+    bad_user_access ();
+  file = positional_file (args[1], args[3], args[4]);
+  if (file == NULL)
+    return -1;
+  return file_write_at (file, (const void *) args[2], args[3], args[4]);
+}
+
+static int
+sys_isdir (const uint32_t *args)
+{
+  struct file_info *dir_fd = files_helper (args[1]);
+  if (dir_fd == NULL)
+    return false;
+  return dir_fd -> dirent -> type == IS_DIR;
+}
+
+static int
+sys_inumber (const uint32_t *args)
+{
+  struct file_info *dir_fd = files_helper (args[1]);
+  if (dir_fd == NULL)
+    return -1;
+  return dir_fd -> dirent -> inode_sector;
+}
+
+static int
+sys_buffer_readcnt (const uint32_t *args UNUSED)
+{
+  return block_print_read_cnt (fs_device);
+}
+
+static int
+sys_buffer_writecnt (const uint32_t *args UNUSED)
+{
+  return block_print_write_cnt (fs_device);
+}
+
+static int
+sys_filesize (const uint32_t *args)
+{
+  struct file_info *curr_file = files_helper (args[1]);
+  if (curr_file == NULL)
+    return -1;
+  return file_length (curr_file->file);
+}
+
+static int
+sys_seek (const uint32_t *args)
+{
+  struct file_info *curr_file = files_helper (args[1]);
+  if (curr_file == NULL)
+    return -1;
+  file_seek (curr_file->file, args[2]);
+  return 0;
+}
+
+static int
+sys_tell (const uint32_t *args)
+{
+  struct file_info *curr_file = files_helper (args[1]);
+  if (curr_file == NULL)
+    return -1;
+  return file_tell (curr_file->file);
+}
+
+static int
+sys_close (const uint32_t *args)
+{
+  struct file_info *curr_file = files_helper (args[1]);
+  if (curr_file == NULL)
+    return -1;
+  thread_current ()->fds[curr_file->file_descriptor] = NULL;
+  if(curr_file -> dirent -> type == IS_REG)
+    file_close (curr_file->file);
+  else
+    dir_close ((struct dir *) curr_file ->file);
+  free(curr_file -> dirent);
+  free(curr_file);
+  return 0;
+}
+
+
+int read (int fd, void *buffer, unsigned length)
+{
+  if (!check_user_buffer (buffer, length, true)) 
+    bad_user_access ();
   else 
     {
       struct file_info *curr_file = files_helper (fd);
@@ -401,18 +642,13 @@ int read (int fd, const void *buffer, unsigned length)
 
 int write (int fd, const void *buffer, unsigned length)
 {
-  uint32_t* pagedir = thread_current()->pagedir;
-
+  if (!check_user_buffer (buffer, length, false))
+    bad_user_access ();
   if (fd == 1) /* if fd == STDOUT_FILENO */
   {
     putbuf(buffer,length);
     return length;
   }
-  void* valid_adress = pagedir_get_page(pagedir, buffer);
-  if (valid_adress == NULL) {
-    handle_exit(-1);
-    thread_exit();
-  } 
   else 
     {
       struct file_info *curr_file = files_helper (fd);
@@ -423,32 +659,212 @@ int write (int fd, const void *buffer, unsigned length)
     } 
 }
 
-int seek (int fd, unsigned length)
+/* The instructions in get_user() and put_user() that access
+   user memory.  The global labels must appear only once, so
+   neither function may be inlined or cloned. */
+extern const char get_user_access[], put_user_access[];
+
+/* Returns true if EIP is the instruction in get_user() or
+   put_user() that accesses user memory.  page_fault() recovers
+   only from faults there. */
+bool
+syscall_user_access (const void *eip)
 {
-  struct file_info *curr_file = files_helper (fd);
-  if(curr_file == NULL)
-    return -1;
-  file_seek(curr_file, length);
+  return eip == get_user_access || eip == put_user_access;
 }
 
-unsigned tell (int fd)
+/* Reads a byte at user virtual address UADDR.
+   Returns the byte value if successful, -1 if UADDR is not a
+   mapped user address.  A fault here is caught by page_fault(),
+   which resumes at the label in EAX with -1 in EAX. */
+static NO_INLINE __attribute__ ((noclone)) int
+get_user (const uint8_t *uaddr)
 {
-  struct file_info *curr_file = files_helper (fd);
-  if (curr_file == NULL)
+  int result;
+  if (!is_user_vaddr (uaddr))
     return -1;
-  unsigned ret = file_tell (curr_file);
-  return ret;
+  asm ("movl $1f, %0; "
+       ".globl get_user_access; get_user_access: movzbl %1, %0; 1:"
+       : "=&a" (result) : "m" (*uaddr));
+  return result;
+}
+
+/* Writes BYTE to user address UDST.
+   Returns true if successful, false if UDST is not a mapped,
+   writable user address. */
+static NO_INLINE __attribute__ ((noclone)) bool
+put_user (uint8_t *udst, uint8_t byte)
+{
+  int error_code;
+  if (!is_user_vaddr (udst))
+    return false;
+  asm ("movl $1f, %0; "
+       ".globl put_user_access; put_user_access: movb %b2, %1; 1:"
+       : "=&a" (error_code), "=m" (*udst) : "q" (byte));
+  return error_code != -1;
+}
+
+/* Copies SIZE bytes from user address USRC to DST.  Returns true
+   if successful, false if any byte is not mapped. */
+static bool
+copy_from_user (void *dst_, const void *usrc_, size_t size)
+{
+  uint8_t *dst = dst_;
+  const uint8_t *usrc = usrc_;
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    {
+      int byte = get_user (usrc + i);
+      if (byte == -1)
+        return false;
+      dst[i] = byte;
+    }
+  return true;
+}
+
+/* Copies SIZE bytes from SRC to user address UDST.  Returns true
+   if successful, false if any byte is not mapped writable. */
+static bool
+copy_to_user (void *udst_, const void *src_, size_t size)
+{
+  uint8_t *udst = udst_;
+  const uint8_t *src = src_;
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    if (!put_user (udst + i, src[i]))
+      return false;
+  return true;
 }
 
+/* Copies the null-terminated string at user address USRC into
+   the SIZE bytes at DST.  Returns the length of the string, SIZE
+   if it did not fit (DST is then truncated but still
+   terminated), or -1 if USRC is a bad address. */
+static int
+strncpy_from_user (char *dst, const char *usrc, size_t size)
+{
+  size_t i;
 
+  ASSERT (size > 0);
+  for (i = 0; i < size; i++)
+    {
+      int byte = get_user ((const uint8_t *) usrc + i);
+      if (byte == -1)
+        return -1;
+      dst[i] = byte;
+      if (byte == '\0')
+        return i;
+    }
+  dst[size - 1] = '\0';
+  return size;
+}
+
+/* Returns true if the SIZE bytes at user address UBUF are all
+   mapped, and writable as well if WRITABLE is true.  Touches one
+   byte per page rather than walking the page table, so that the
+   kernel can then access the buffer directly. */
+static bool
+check_user_buffer (const void *ubuf_, size_t size, bool writable)
+{
+  const uint8_t *ubuf = ubuf_;
+  const uint8_t *page;
+
+  if (size == 0)
+    return true;
+  if (ubuf + size < ubuf || !is_user_vaddr (ubuf + size - 1))
+    return false;
+  for (page = pg_round_down (ubuf); page < ubuf + size; page += PGSIZE)
+    {
+      const uint8_t *probe = page < ubuf ? ubuf : page;
+      int byte = get_user (probe);
+      if (byte == -1 || (writable && !put_user ((uint8_t *) probe, byte)))
+        return false;
+    }
+  return true;
+}
+
+/* Copies the null-terminated string at user address USTR into a
+   new page and returns it.  The caller must free the page with
+   palloc_free_page().  Returns a null pointer if the string does
+   not fit in a page or memory is short.  Kills the process if
+   USTR is a bad address. */
+static char *
+copy_in_string (const char *ustr)
+{
+  char *kstr = palloc_get_page (0);
+  int len;
+
+  if (kstr == NULL)
+    return NULL;
+  len = strncpy_from_user (kstr, ustr, PGSIZE);
+  if (len < 0)
+    {
+      palloc_free_page (kstr);
+      bad_user_access ();
+    }
+  if (len >= PGSIZE)
+    {
+      palloc_free_page (kstr);
+      return NULL;
+    }
+  return kstr;
+}
+
+/* Terminates the current process for passing a bad pointer. */
+static void
+bad_user_access (void)
+{
+  handle_exit (-1);
+  thread_exit ();
+}
+
+/* Installs FI in the current thread's descriptor table at the
+   lowest free fd, doubling the table if it is full, and returns
+   the fd.  Returns -1 if memory is short. */
+static int
+install_fd (struct file_info *fi)
+{
+  struct thread *t = thread_current ();
+  int fd;
+
+  for (fd = FD_FIRST; fd < t->fd_cnt; fd++)
+    if (t->fds[fd] == NULL)
+      break;
+  if (fd >= t->fd_cnt)
+    {
+      int new_cnt = t->fd_cnt > 0 ? t->fd_cnt * 2 : 16;
+      struct file_info **fds = realloc (t->fds, new_cnt * sizeof *fds);
+      if (fds == NULL)
+        return -1;
+      memset (fds + t->fd_cnt, 0, (new_cnt - t->fd_cnt) * sizeof *fds);
+      fd = t->fd_cnt > FD_FIRST ? t->fd_cnt : FD_FIRST;
+      t->fds = fds;
+      t->fd_cnt = new_cnt;
+    }
+  t->fds[fd] = fi;
+  return fd;
+}
+
+/* Creates the file info for OPEN_FILE and gives it a file
+   descriptor.  Returns a null pointer if memory is short. */
 struct file_info*
 create_files_struct(struct file *open_file) 
 {
   struct file_info *f1 = malloc(sizeof(struct file_info));
+  if (f1 == NULL)
+    return NULL;
   f1->reader_count = 0;
-  f1->file_descriptor = find_fd();
   f1->file = open_file;
+  f1->dirent = NULL;
   f1->removed = false;
+  f1->file_descriptor = install_fd (f1);
+  if (f1->file_descriptor < 0)
+    {
+      free (f1);
+      return NULL;
+    }
   return f1;
 }
 
@@ -457,30 +873,11 @@ create_files_struct(struct file *open_file)
 struct file_info* 
 files_helper (int fd) 
 {
-  // Loop over the current file list
-  struct list_elem *e;
-  struct file_info *f;
-  struct list open_list = thread_current()->open_list;
-  int maxfd = thread_current()->fd_count;
+  struct thread *t = thread_current ();
 
-  if (list_empty(&open_list)) 
+  if (fd < FD_FIRST || fd >= t->fd_cnt)
     return NULL;
-  
-
-
-  for(e = list_begin (&open_list); e != list_end (&open_list);
-      e = list_next (e))
-    {
-      f = list_entry (e, struct file_info, elem);
-      if (f->file_descriptor == fd)
-      {
-        return f;
-      }
-      if (f->file_descriptor >= maxfd) {
-        return NULL;
-      }
-    }
-  return NULL;
+  return t->fds[fd];
 }
 
 /* handling exit of a process
@@ -529,8 +926,6 @@ handle_exit(int ret_val)
 tid_t 
 handle_exec(const char *cmd_line)
 {
-  if (cmd_line > PHYS_BASE) 
-    return -1;
   tid_t child_tid;
   child_tid = process_execute (cmd_line); 
   return child_tid; 
@@ -542,12 +937,21 @@ handle_exec(const char *cmd_line)
 void clear_all_file()
 {
   struct thread *t = thread_current();
-  struct list_elem* e;
-  while (list_size (&(t -> open_list)))
-  {
-    e = list_pop_front (& (t -> open_list));
-    struct file_info* fi = list_entry(e, struct file_info, elem);
-    file_close (fi-> file);
-    free(fi);
-  }
+  int fd;
+
+  for (fd = FD_FIRST; fd < t->fd_cnt; fd++)
+    {
+      struct file_info *fi = t->fds[fd];
+      if (fi == NULL)
+        continue;
+      if (fi->dirent != NULL && fi->dirent->type == IS_DIR)
+        dir_close ((struct dir *) fi->file);
+      else
+        file_close (fi->file);
+      free (fi->dirent);
+      free (fi);
+    }
+  free (t->fds);
+  t->fds = NULL;
+  t->fd_cnt = 0;
 }
@@ -15,16 +15,20 @@
 #include "userprog/pagedir.h"
 #include "filesys/directory.h"
 
+/* File descriptors below this are reserved for the console. */
+#define FD_FIRST 3
+
 struct file_info
   {
     int reader_count;
     int file_descriptor;
     struct file *file;
     struct dir_entry* dirent; 
-    struct list_elem elem;
     bool removed;
   };
 
 void syscall_init (void);
+void syscall_print_stats (void);
+bool syscall_user_access (const void *eip);
 
 #endif /* userprog/syscall.h */